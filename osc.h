@@ -24,6 +24,7 @@
 #include <ctype.h>
 
 #include "osc_platform.h"
+#include "osc_swap.h"
 
 #define OSC_PADDED_SIZE(size) ( ( (size_t)(size) + 3 ) & ( ~3 ) )
 
@@ -33,6 +34,7 @@ typedef uint8_t osc_data_t;
 typedef uint64_t osc_time_t;
 typedef struct _osc_blob_t osc_blob_t;
 typedef union _osc_argument_t osc_argument_t;
+typedef struct _osc_array_t osc_array_t;
 
 typedef int (*osc_method_cb_t)(osc_time_t time, const char *path, const char *fmt,
 	const osc_data_t *arg, size_t size, void *data);
@@ -106,6 +108,13 @@ struct _osc_blob_t {
 	const void *payload;
 };
 
+// homogeneous array of fixed-size values, payload in network byte order
+struct _osc_array_t {
+	osc_type_t type;
+	uint32_t count;
+	const osc_data_t *payload;
+};
+
 union _osc_argument_t {
 	int32_t i;
 	float f;
@@ -121,6 +130,18 @@ union _osc_argument_t {
 	const uint8_t *m;
 };
 
+// reason for rejecting a packet, see osc_check_*_reason
+typedef enum _osc_check_t {
+	OSC_CHECK_OK = 0,
+	OSC_CHECK_TYPE, // neither message nor bundle
+	OSC_CHECK_PATH,
+	OSC_CHECK_FMT,
+	OSC_CHECK_ARRAY, // unbalanced array markers
+	OSC_CHECK_SIZE, // arguments do not fill message exactly
+	OSC_CHECK_BUNDLE, // bad bundle header or item size
+	OSC_CHECK_ITEM // bundle item neither message nor bundle
+} osc_check_t;
+
 typedef enum _osc_unroll_mode_t {
 	OSC_UNROLL_MODE_NONE,
 	OSC_UNROLL_MODE_PARTIAL,
@@ -383,6 +404,54 @@ osc_bloblen(const osc_data_t *buf)
 	return 4 + OSC_PADDED_SIZE(osc_blobsize(buf));
 }
 
+// payload size of fixed-size types, -1 for variable-size types
+static inline int
+osc_type_size(osc_type_t type)
+{
+	switch(type)
+	{
+		case OSC_INT32:
+		case OSC_FLOAT:
+		case OSC_CHAR:
+		case OSC_MIDI:
+		case OSC_RGBA:
+			return 4;
+
+		case OSC_INT64:
+		case OSC_DOUBLE:
+		case OSC_TIMETAG:
+			return 8;
+
+		case OSC_TRUE:
+		case OSC_FALSE:
+		case OSC_NIL:
+		case OSC_BANG:
+		case OSC_AOPEN:
+		case OSC_ACLOSE:
+			return 0;
+
+		default:
+			return -1;
+	}
+}
+
+// hash raw OSC objects (FNV-1a)
+static inline uint32_t
+osc_hash(const void *buf, size_t len)
+{
+	const uint8_t *ptr = (const uint8_t *)buf;
+	uint32_t hash = 0x811c9dc5;
+
+	size_t i;
+	for(i=0; i<len; i++)
+	{
+		hash ^= ptr[i];
+		hash *= 0x01000193;
+	}
+
+	return hash;
+}
+
 // get OSC arguments from raw buffer
 static inline const osc_data_t *
 osc_get_path(const osc_data_t *buf, const char **path)
@@ -476,6 +545,14 @@ osc_get_timetag(const osc_data_t *buf, osc_time_t *t)
 	return buf + 8;
 }
 
+static inline const osc_data_t *
+osc_get_bundle(const osc_data_t *buf, osc_time_t *t)
+{
+	if(!buf || strncmp((const char *)buf, "#bundle", 8)) // bundle header valid?
+		return NULL;
+	return osc_get_timetag(buf + 8, t);
+}
+
 static inline const osc_data_t *
 osc_get_symbol(const osc_data_t *buf, const char **S)
 {
@@ -505,6 +582,105 @@ osc_get_midi(const osc_data_t *buf, const uint8_t **m)
 	return buf + 4;
 }
 
+// get homogeneous array of fixed-size values, *type must point to its
+// OSC_AOPEN and is advanced past its OSC_ACLOSE, mixed, nested or empty
+// arrays are not handled and need to be walked element-wise with osc_get
+static inline const osc_data_t *
+osc_get_array(const char **type, const osc_data_t *buf, osc_array_t *arr)
+{
+	if(!buf || (**type != OSC_AOPEN) )
+		return NULL;
+
+	const char *ptr = *type + 1;
+	const osc_type_t t = (osc_type_t)*ptr;
+	const int size = osc_type_size(t);
+	if(size <= 0)
+		return NULL;
+
+	uint32_t count = 0;
+	for( ; (osc_type_t)*ptr == t; ptr++)
+		count++;
+	if(*ptr != OSC_ACLOSE)
+		return NULL;
+
+	arr->type = t;
+	arr->count = count;
+	arr->payload = buf;
+	*type = ptr + 1;
+	return buf + count*size;
+}
+
+// convert whole array to host byte order, 32-bit types end up as 32-bit
+// words, 64-bit types as 64-bit words, OSC_MIDI is copied as is
+static inline void
+osc_get_array_values(const osc_array_t *arr, void *dst)
+{
+	const uint32_t n = arr->count;
+
+	if(arr->type == OSC_MIDI)
+	{
+		memcpy(dst, arr->payload, n*4);
+		return;
+	}
+
+	switch(osc_type_size(arr->type))
+	{
+		case 4:
+			osc_swap32_n(dst, arr->payload, n);
+			break;
+		case 8:
+			osc_swap64_n(dst, arr->payload, n);
+			break;
+	}
+}
+
+// length of run of identical numeric types starting at type
+static inline uint32_t
+osc_fmt_run(const char *type)
+{
+	switch(*type)
+	{
+		case OSC_INT32:
+		case OSC_FLOAT:
+		case OSC_RGBA:
+		case OSC_INT64:
+		case OSC_DOUBLE:
+		case OSC_TIMETAG:
+			break;
+		default:
+			return 0;
+	}
+
+	const char *ptr;
+	for(ptr=type; *ptr == *type; ptr++)
+		;
+
+	return ptr - type;
+}
+
+// convert run of identical numeric types at *type to host byte order,
+// at most max values, *type is advanced past the converted values
+static inline const osc_data_t *
+osc_get_run(const char **type, const osc_data_t *buf, void *dst, uint32_t max,
+	uint32_t *count)
+{
+	uint32_t n = osc_fmt_run(*type);
+	if(!buf || !n)
+		return NULL;
+	if(n > max)
+		n = max;
+
+	const int size = osc_type_size((osc_type_t)**type);
+	if(size == 4)
+		osc_swap32_n(dst, buf, n);
+	else
+		osc_swap64_n(dst, buf, n);
+
+	*type += n;
+	*count = n;
+	return buf + n*size;
+}
+
 static inline const osc_data_t *
 osc_get(osc_type_t type, const osc_data_t *buf, osc_argument_t *arg)
 {
@@ -531,6 +707,8 @@ osc_get(osc_type_t type, const osc_data_t *buf, osc_argument_t *arg)
 		case OSC_FALSE:
 		case OSC_NIL:
 		case OSC_BANG:
+		case OSC_AOPEN:
+		case OSC_ACLOSE:
 			return buf;
 
 		case OSC_SYMBOL:
@@ -557,7 +735,7 @@ osc_get_vararg(const osc_data_t *buf, const char **path, const char **fmt, ...)
 	ptr = osc_get_fmt(ptr, fmt);
 
   const char *type;
-  for(type=*fmt; *type != '\0'; type++)
+  for(type=*fmt+1; *type != '\0'; type++)
 		switch(*type)
 		{
 			case OSC_INT32:
@@ -587,6 +765,8 @@ osc_get_vararg(const osc_data_t *buf, const char **path, const char **fmt, ...)
 			case OSC_FALSE:
 			case OSC_NIL:
 			case OSC_BANG:
+			case OSC_AOPEN:
+			case OSC_ACLOSE:
 				break;
 
 			case OSC_SYMBOL:
@@ -609,8 +789,8 @@ osc_get_vararg(const osc_data_t *buf, const char **path, const char **fmt, ...)
 	return ptr;
 }
 
-static inline int
-osc_check_message(const osc_data_t *buf, size_t size)
+static inline osc_check_t
+osc_check_message_reason(const osc_data_t *buf, size_t size)
 {
 	const osc_data_t *ptr = buf;
 	const osc_data_t *end = buf + size;
@@ -620,17 +800,26 @@ osc_check_message(const osc_data_t *buf, size_t size)
 
 	ptr = osc_get_path(ptr, &path);
 	if( (ptr > end) || !osc_check_path(path) )
-		return 0;
+		return OSC_CHECK_PATH;
 
 	ptr = osc_get_fmt(ptr, &fmt);
 	if( (ptr > end) || !osc_check_fmt(fmt, 1) )
-		return 0;
+		return OSC_CHECK_FMT;
 
+	int depth = 0;
 	const char *type;
 	for(type=fmt+1; (*type!='\0') && (ptr <= end); type++)
 	{
 		switch(*type)
 		{
+			case OSC_AOPEN:
+				depth++;
+				break;
+			case OSC_ACLOSE:
+				if(--depth < 0) // unbalanced array
+					return OSC_CHECK_ARRAY;
+				break;
+
 			case OSC_INT32:
 			case OSC_FLOAT:
 			case OSC_MIDI:
@@ -661,17 +850,26 @@ osc_check_message(const osc_data_t *buf, size_t size)
 		}
 	}
 
-	return ptr == end;
+	if(ptr != end)
+		return OSC_CHECK_SIZE;
+
+	return depth ? OSC_CHECK_ARRAY : OSC_CHECK_OK;
 }
 
 static inline int
-osc_check_bundle(const osc_data_t *buf, size_t size)
+osc_check_message(const osc_data_t *buf, size_t size)
+{
+	return osc_check_message_reason(buf, size) == OSC_CHECK_OK;
+}
+
+static inline osc_check_t
+osc_check_bundle_reason(const osc_data_t *buf, size_t size)
 {
 	const osc_data_t *ptr = buf;
 	const osc_data_t *end = buf + size;
 
 	if(strncmp((const char *)ptr, "#bundle", 8)) // bundle header valid?
-		return 0;
+		return OSC_CHECK_BUNDLE;
 	ptr += 16; // skip bundle header
 
 	while(ptr < end)
@@ -680,45 +878,52 @@ osc_check_bundle(const osc_data_t *buf, size_t size)
 		int32_t hlen = be32toh(*len);
 		ptr += sizeof(int32_t);
 
+		osc_check_t reason;
 		switch(*ptr)
 		{
 			case '#':
-				if(!osc_check_bundle(ptr, hlen))
-					return 0;
+				if( (reason = osc_check_bundle_reason(ptr, hlen)) )
+					return reason;
 				break;
 			case '/':
-				if(!osc_check_message(ptr, hlen))
-					return 0;
+				if( (reason = osc_check_message_reason(ptr, hlen)) )
+					return reason;
 				break;
 			default:
-				return 0;
+				return OSC_CHECK_ITEM;
 		}
 		ptr += hlen;
 	}
 
-	return ptr == end;
+	return (ptr == end) ? OSC_CHECK_OK : OSC_CHECK_BUNDLE;
 }
 
 static inline int
-osc_check_packet(const osc_data_t *buf, size_t size)
+osc_check_bundle(const osc_data_t *buf, size_t size)
+{
+	return osc_check_bundle_reason(buf, size) == OSC_CHECK_OK;
+}
+
+static inline osc_check_t
+osc_check_packet_reason(const osc_data_t *buf, size_t size)
 {
 	const osc_data_t *ptr = buf;
 
 	switch(*ptr)
 	{
 		case '#':
-			if(!osc_check_bundle(ptr, size))
-				return 0;
-			break;
+			return osc_check_bundle_reason(ptr, size);
 		case '/':
-			if(!osc_check_message(ptr, size))
-				return 0;
-			break;
-		default:
-			return 0;
+			return osc_check_message_reason(ptr, size);
 	}
 
-	return 1;
+	return OSC_CHECK_TYPE;
+}
+
+static inline int
+osc_check_packet(const osc_data_t *buf, size_t size)
+{
+	return osc_check_packet_reason(buf, size) == OSC_CHECK_OK;
 }
 
 static inline int
@@ -761,11 +966,12 @@ _osc_method_dispatch_bundle(const osc_data_t *buf, size_t size,
 	const osc_method_t *methods, osc_bundle_in_cb_t bundle_in,
 	osc_bundle_out_cb_t bundle_out, void *data)
 {
-	const osc_data_t *ptr = buf;
 	const osc_data_t *end = buf + size;
 
-	uint64_t time = be64toh(*(const uint64_t *)(ptr + 8));
-	ptr += 16; // skip bundle header
+	osc_time_t time;
+	const osc_data_t *ptr = osc_get_bundle(buf, &time); // skip bundle header
+	if(!ptr)
+		return;
 
 	if(bundle_in)
 		bundle_in(time, data);
@@ -961,6 +1167,75 @@ osc_set_midi_inline(osc_data_t *buf, const osc_data_t *end, uint8_t **m)
 	return buf + 4;
 }
 
+// write count values of a fixed-size type from host byte order, see
+// osc_get_array_values for the layout of src, the matching format is
+// written with osc_fmt_array
+static inline osc_data_t *
+osc_set_array(osc_data_t *buf, const osc_data_t *end, osc_type_t type,
+	uint32_t count, const void *src)
+{
+	const int size = osc_type_size(type);
+	// divide instead of multiply, count*size may overflow
+	if(!buf || (size <= 0) || (count > (size_t)(end - buf) / size) )
+		return NULL;
+
+	const size_t len = (size_t)count * size;
+
+	if(type == OSC_MIDI)
+	{
+		memcpy(buf, src, len);
+		return buf + len;
+	}
+
+	switch(size)
+	{
+		case 4:
+			osc_swap32_n(buf, src, count);
+			break;
+		case 8:
+			osc_swap64_n(buf, src, count);
+			break;
+	}
+
+	return buf + len;
+}
+
+// write run of identical numeric types at *type from host byte order,
+// at most max values, *type is advanced past the written values
+static inline osc_data_t *
+osc_set_run(osc_data_t *buf, const osc_data_t *end, const char **type,
+	const void *src, uint32_t max, uint32_t *count)
+{
+	uint32_t n = osc_fmt_run(*type);
+	if(n > max)
+		n = max;
+
+	osc_data_t *ptr = n ? osc_set_array(buf, end, (osc_type_t)**type, n, src) : NULL;
+	if(!ptr)
+		return NULL;
+
+	*type += n;
+	*count = n;
+	return ptr;
+}
+
+// append array of count values of type to format string,
+// returns the new terminating zero for further appending
+static inline char *
+osc_fmt_array(char *fmt, const char *end, osc_type_t type, uint32_t count)
+{
+	if(!fmt || (fmt + count + 3 > end) )
+		return NULL;
+
+	*fmt++ = OSC_AOPEN;
+	memset(fmt, type, count);
+	fmt += count;
+	*fmt++ = OSC_ACLOSE;
+	*fmt = '\0';
+
+	return fmt;
+}
+
 static inline osc_data_t *
 osc_start_bundle(osc_data_t *buf, const osc_data_t *end, osc_time_t t, osc_data_t **bndl)
 {
@@ -1030,6 +1305,8 @@ osc_set(osc_data_t *buf, const osc_data_t *end, osc_type_t type, osc_argument_t
 		case OSC_FALSE:
 		case OSC_NIL:
 		case OSC_BANG:
+		case OSC_AOPEN:
+		case OSC_ACLOSE:
 			return buf;
 
 		case OSC_SYMBOL:
@@ -1067,8 +1344,12 @@ osc_set_varlist(osc_data_t *buf, const osc_data_t *end, const char *path,
 				ptr = osc_set_string(ptr, end, va_arg(args, const char *));
 				break;
 			case OSC_BLOB:
-				ptr = osc_set_blob(ptr, end, va_arg(args, int32_t), va_arg(args, const void *));
+			{
+				// evaluation order of function arguments is unspecified
+				const int32_t size = va_arg(args, int32_t);
+				ptr = osc_set_blob(ptr, end, size, va_arg(args, const void *));
 				break;
+			}
 
 			case OSC_INT64:
 				ptr = osc_set_int64(ptr, end, va_arg(args, int64_t));
@@ -1084,6 +1365,8 @@ osc_set_varlist(osc_data_t *buf, const osc_data_t *end, const char *path,
 			case OSC_FALSE:
 			case OSC_NIL:
 			case OSC_BANG:
+			case OSC_AOPEN:
+			case OSC_ACLOSE:
 				break;
 
 			case OSC_SYMBOL:
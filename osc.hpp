@@ -1,3 +1,1413 @@
+/*
+ * Copyright (c) 2015 Hanspeter Portner (dev@open-music-kontrollers.ch)
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the Artistic License 2.0 as published by
+ * The Perl Foundation.
+ *
+ * This source is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * Artistic License 2.0 for more details.
+ *
+ * You should have received a copy of the Artistic License 2.0
+ * along the source as a COPYING file. If not, obtain it from
+ * http://www.perlfoundation.org/artistic_license_2_0.
+ */
+
+#ifndef _LIB_OSC_HPP_
+#define _LIB_OSC_HPP_
+
 extern "C" {
 #include "osc.h"
 }
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace osc {
+
+/*
+ * Zero-copy views, C++20.
+ *
+ * Views are non-owning and trivially copyable, they never allocate nor
+ * throw. A message_view parses path and format on construction and caches
+ * the offsets of the first max_cached arguments, later arguments are found
+ * by walking on from the last cached one. Malformed input yields empty
+ * results rather than out-of-bounds reads. Everything but accessors
+ * returning std::string_view can be evaluated at compile time.
+ */
+
+namespace detail {
+
+constexpr size_t npos = SIZE_MAX;
+
+constexpr char hex_digits [] = "0123456789abcdef";
+
+constexpr size_t
+padded(size_t size) noexcept
+{
+	return (size + 3) & ~size_t(3);
+}
+
+constexpr uint32_t
+load32(const std::byte *ptr) noexcept
+{
+	return (uint32_t(ptr[0]) << 24) | (uint32_t(ptr[1]) << 16)
+		| (uint32_t(ptr[2]) << 8) | uint32_t(ptr[3]);
+}
+
+constexpr uint64_t
+load64(const std::byte *ptr) noexcept
+{
+	return (uint64_t(load32(ptr)) << 32) | load32(ptr + 4);
+}
+
+// length of zero-terminated string within buf, npos if unterminated
+constexpr size_t
+strlen(std::span<const std::byte> buf) noexcept
+{
+	for(size_t i = 0; i < buf.size(); i++)
+		if(buf[i] == std::byte{0})
+			return i;
+	return npos;
+}
+
+// padded size of argument of type at start of buf, npos if out of bounds
+constexpr size_t
+arg_size(char type, std::span<const std::byte> buf) noexcept
+{
+	size_t size = npos;
+
+	switch(type)
+	{
+		case OSC_INT32: case OSC_FLOAT: case OSC_CHAR: case OSC_MIDI: case OSC_RGBA:
+			size = 4;
+			break;
+		case OSC_INT64: case OSC_DOUBLE: case OSC_TIMETAG:
+			size = 8;
+			break;
+		case OSC_TRUE: case OSC_FALSE: case OSC_NIL: case OSC_BANG:
+		case OSC_AOPEN: case OSC_ACLOSE:
+			size = 0;
+			break;
+		case OSC_STRING: case OSC_SYMBOL:
+		{
+			const size_t len = strlen(buf);
+			size = (len == npos) ? npos : padded(len + 1);
+			break;
+		}
+		case OSC_BLOB:
+			if(buf.size() >= 4)
+			{
+				const int32_t len = int32_t(load32(buf.data()));
+				size = (len < 0) ? npos : 4 + padded(size_t(len));
+			}
+			break;
+	}
+
+	return (size <= buf.size()) ? size : npos;
+}
+
+} // namespace detail
+
+class argument
+{
+public:
+	constexpr argument() noexcept = default;
+
+	constexpr argument(char type, std::span<const std::byte> data) noexcept
+		: type_(type), data_(data)
+	{}
+
+	constexpr char
+	type() const noexcept
+	{
+		return type_;
+	}
+
+	// raw payload in network byte order
+	constexpr std::span<const std::byte>
+	data() const noexcept
+	{
+		return data_;
+	}
+
+	// typed value, empty if T does not fit the argument type
+	template<typename T>
+	constexpr std::optional<T>
+	as() const noexcept
+	{
+		if constexpr(std::is_same_v<T, int32_t>)
+		{
+			if(type_ == OSC_INT32)
+				return int32_t(detail::load32(data_.data()));
+		}
+		else if constexpr(std::is_same_v<T, uint32_t>) // rgba
+		{
+			if(type_ == OSC_RGBA)
+				return detail::load32(data_.data());
+		}
+		else if constexpr(std::is_same_v<T, float>)
+		{
+			if(type_ == OSC_FLOAT)
+				return std::bit_cast<float>(detail::load32(data_.data()));
+		}
+		else if constexpr(std::is_same_v<T, int64_t>)
+		{
+			if(type_ == OSC_INT64)
+				return int64_t(detail::load64(data_.data()));
+		}
+		else if constexpr(std::is_same_v<T, osc_time_t>)
+		{
+			if(type_ == OSC_TIMETAG)
+				return detail::load64(data_.data());
+		}
+		else if constexpr(std::is_same_v<T, double>)
+		{
+			if(type_ == OSC_DOUBLE)
+				return std::bit_cast<double>(detail::load64(data_.data()));
+		}
+		else if constexpr(std::is_same_v<T, char>)
+		{
+			if(type_ == OSC_CHAR)
+				return char(detail::load32(data_.data()) & 0xff);
+		}
+		else if constexpr(std::is_same_v<T, bool>)
+		{
+			if( (type_ == OSC_TRUE) || (type_ == OSC_FALSE) )
+				return type_ == OSC_TRUE;
+		}
+		else if constexpr(std::is_same_v<T, std::string_view>)
+		{
+			if( (type_ == OSC_STRING) || (type_ == OSC_SYMBOL) )
+			{
+				return std::string_view(reinterpret_cast<const char *>(data_.data()),
+					detail::strlen(data_));
+			}
+		}
+		else if constexpr(std::is_same_v<T, std::span<const std::byte>>) // blob
+		{
+			if(type_ == OSC_BLOB)
+				return data_.subspan(4, detail::load32(data_.data()));
+		}
+		else if constexpr(std::is_same_v<T, std::array<uint8_t, 4>>) // midi
+		{
+			if(type_ == OSC_MIDI)
+				return std::array<uint8_t, 4>{uint8_t(data_[0]), uint8_t(data_[1]),
+					uint8_t(data_[2]), uint8_t(data_[3])};
+		}
+		else
+		{
+			static_assert(sizeof(T) == 0, "unsupported argument type");
+		}
+
+		return std::nullopt;
+	}
+
+private:
+	char type_ = '\0';
+	std::span<const std::byte> data_;
+};
+
+class message_view
+{
+public:
+	static constexpr size_t max_cached = 16;
+
+	class iterator
+	{
+	public:
+		using value_type = argument;
+		using difference_type = std::ptrdiff_t;
+
+		constexpr iterator() noexcept = default;
+
+		constexpr iterator(const message_view *msg, size_t idx, size_t off) noexcept
+			: msg_(msg), idx_(idx), off_(off)
+		{
+			load();
+		}
+
+		constexpr argument
+		operator*() const noexcept
+		{
+			return arg_;
+		}
+
+		constexpr iterator &
+		operator++() noexcept
+		{
+			off_ += arg_.data().size();
+			idx_++;
+			load();
+			return *this;
+		}
+
+		constexpr iterator
+		operator++(int) noexcept
+		{
+			iterator tmp = *this;
+			++*this;
+			return tmp;
+		}
+
+		constexpr bool
+		operator==(const iterator &other) const noexcept
+		{
+			return idx_ == other.idx_;
+		}
+
+	private:
+		constexpr void
+		load() noexcept
+		{
+			if(idx_ < msg_->size())
+			{
+				arg_ = msg_->arg_at(idx_, off_);
+				if(arg_.type() == '\0') // malformed, stop here
+					idx_ = msg_->size();
+			}
+		}
+
+		const message_view *msg_ = nullptr;
+		size_t idx_ = 0;
+		size_t off_ = 0;
+		argument arg_;
+	};
+
+	constexpr message_view() noexcept = default;
+
+	explicit constexpr message_view(std::span<const std::byte> buf) noexcept
+		: buf_(buf)
+	{
+		parse();
+	}
+
+	message_view(const osc_data_t *buf, size_t size) noexcept
+		: buf_(reinterpret_cast<const std::byte *>(buf), size)
+	{
+		parse();
+	}
+
+	constexpr std::span<const std::byte>
+	data() const noexcept
+	{
+		return buf_;
+	}
+
+	// header is well-formed
+	constexpr bool
+	header_valid() const noexcept
+	{
+		return nfmt_ != detail::npos;
+	}
+
+	// whole message is well-formed and all arguments fill it exactly
+	constexpr bool
+	valid() const noexcept
+	{
+		if(!header_valid())
+			return false;
+
+		size_t off = args_;
+		for(size_t i = 0; i < nfmt_; i++)
+		{
+			const size_t size = detail::arg_size(fmt_at(i), rest(off));
+			if(size == detail::npos)
+				return false;
+			off += size;
+		}
+
+		return off == buf_.size();
+	}
+
+	std::string_view
+	path() const noexcept
+	{
+		if(nfmt_ == detail::npos)
+			return {};
+		return std::string_view(reinterpret_cast<const char *>(buf_.data()), npath_);
+	}
+
+	// format without leading ','
+	std::string_view
+	format() const noexcept
+	{
+		if(nfmt_ == detail::npos)
+			return {};
+		return std::string_view(reinterpret_cast<const char *>(buf_.data()) + fmt_ + 1,
+			nfmt_);
+	}
+
+	// number of format characters, array markers included
+	constexpr size_t
+	size() const noexcept
+	{
+		return (nfmt_ == detail::npos) ? 0 : nfmt_;
+	}
+
+	// argument at format position i, default-constructed if out of range
+	constexpr argument
+	operator[](size_t i) const noexcept
+	{
+		if(i >= size())
+			return {};
+
+		if(i < ncached_)
+			return arg_at(i, offsets_[i]);
+
+		// walk on from last cached argument
+		size_t j = ncached_ - 1;
+		size_t off = offsets_[j];
+		for( ; j < i; j++)
+		{
+			const size_t sz = detail::arg_size(fmt_at(j), rest(off));
+			if(sz == detail::npos)
+				return {};
+			off += sz;
+		}
+
+		return arg_at(i, off);
+	}
+
+	template<typename T>
+	constexpr std::optional<T>
+	get(size_t i) const noexcept
+	{
+		const argument arg = (*this)[i];
+		if(arg.type() == '\0')
+			return std::nullopt;
+		return arg.as<T>();
+	}
+
+	constexpr iterator
+	begin() const noexcept
+	{
+		return iterator(this, 0, args_);
+	}
+
+	constexpr iterator
+	end() const noexcept
+	{
+		return iterator(this, size(), 0);
+	}
+
+private:
+	constexpr char
+	fmt_at(size_t i) const noexcept
+	{
+		return char(buf_[fmt_ + 1 + i]);
+	}
+
+	// bytes from off on, empty past the end
+	constexpr std::span<const std::byte>
+	rest(size_t off) const noexcept
+	{
+		return buf_.subspan(off < buf_.size() ? off : buf_.size());
+	}
+
+	constexpr argument
+	arg_at(size_t i, size_t off) const noexcept
+	{
+		const char type = fmt_at(i);
+		const auto tail = rest(off);
+		const size_t size = detail::arg_size(type, tail);
+		if(size == detail::npos)
+			return {};
+		return argument(type, tail.first(size));
+	}
+
+	constexpr void
+	parse() noexcept
+	{
+		nfmt_ = detail::npos;
+		if(buf_.empty())
+			return;
+
+		const size_t npath = detail::strlen(buf_);
+		if( (npath == detail::npos) || (buf_[0] != std::byte{'/'}) )
+			return;
+
+		const size_t fmt = detail::padded(npath + 1);
+		if( (fmt >= buf_.size()) || (buf_[fmt] != std::byte{','}) )
+			return;
+
+		const size_t nfmt = detail::strlen(buf_.subspan(fmt));
+		if(nfmt == detail::npos)
+			return;
+
+		const size_t args = fmt + detail::padded(nfmt + 1);
+		if(args > buf_.size()) // format padding truncated
+			return;
+
+		npath_ = npath;
+		fmt_ = fmt;
+		nfmt_ = nfmt - 1;
+		args_ = args;
+
+		// cache leading argument offsets
+		size_t off = args_;
+		for(ncached_ = 0; (ncached_ < nfmt_) && (ncached_ < max_cached); ncached_++)
+		{
+			offsets_[ncached_] = off;
+			const size_t size = detail::arg_size(fmt_at(ncached_), rest(off));
+			if(size == detail::npos)
+			{
+				ncached_++;
+				break;
+			}
+			off += size;
+		}
+	}
+
+	std::span<const std::byte> buf_;
+
+	size_t npath_ = 0;
+	size_t fmt_ = 0;
+	size_t nfmt_ = detail::npos;
+	size_t args_ = 0;
+	size_t ncached_ = 0;
+	std::array<uint32_t, max_cached> offsets_ = {};
+};
+
+class bundle_view;
+
+// item of a bundle, either a message or a nested bundle
+class element
+{
+public:
+	constexpr element() noexcept = default;
+
+	explicit constexpr element(std::span<const std::byte> buf) noexcept
+		: buf_(buf)
+	{}
+
+	constexpr std::span<const std::byte>
+	data() const noexcept
+	{
+		return buf_;
+	}
+
+	constexpr bool
+	is_message() const noexcept
+	{
+		return !buf_.empty() && (buf_[0] == std::byte{'/'});
+	}
+
+	constexpr bool
+	is_bundle() const noexcept
+	{
+		return !buf_.empty() && (buf_[0] == std::byte{'#'});
+	}
+
+	constexpr message_view
+	message() const noexcept
+	{
+		return is_message() ? message_view(buf_) : message_view();
+	}
+
+	constexpr bundle_view
+	bundle() const noexcept;
+
+private:
+	std::span<const std::byte> buf_;
+};
+
+class bundle_view
+{
+public:
+	class iterator
+	{
+	public:
+		using value_type = element;
+		using difference_type = std::ptrdiff_t;
+
+		constexpr iterator() noexcept = default;
+
+		constexpr iterator(std::span<const std::byte> rest, bool nested_only) noexcept
+			: rest_(rest), nested_only_(nested_only)
+		{
+			load();
+		}
+
+		constexpr element
+		operator*() const noexcept
+		{
+			return elmnt_;
+		}
+
+		constexpr iterator &
+		operator++() noexcept
+		{
+			rest_ = rest_.subspan(4 + elmnt_.data().size());
+			load();
+			return *this;
+		}
+
+		constexpr iterator
+		operator++(int) noexcept
+		{
+			iterator tmp = *this;
+			++*this;
+			return tmp;
+		}
+
+		constexpr bool
+		operator==(const iterator &other) const noexcept
+		{
+			return rest_.size() == other.rest_.size();
+		}
+
+	private:
+		constexpr void
+		load() noexcept
+		{
+			while(rest_.size() >= 4)
+			{
+				const int32_t len = int32_t(detail::load32(rest_.data()));
+				if( (len <= 0) || (size_t(len) > rest_.size() - 4) )
+					break; // malformed, stop here
+
+				elmnt_ = element(rest_.subspan(4, len));
+				if(!nested_only_ || elmnt_.is_bundle())
+					return;
+
+				rest_ = rest_.subspan(4 + len);
+			}
+
+			rest_ = {};
+		}
+
+		std::span<const std::byte> rest_;
+		bool nested_only_ = false;
+		element elmnt_;
+	};
+
+	// range over nested bundles only
+	class nested_range
+	{
+	public:
+		explicit constexpr nested_range(std::span<const std::byte> items) noexcept
+			: items_(items)
+		{}
+
+		constexpr iterator
+		begin() const noexcept
+		{
+			return iterator(items_, true);
+		}
+
+		constexpr iterator
+		end() const noexcept
+		{
+			return iterator();
+		}
+
+	private:
+		std::span<const std::byte> items_;
+	};
+
+	constexpr bundle_view() noexcept = default;
+
+	explicit constexpr bundle_view(std::span<const std::byte> buf) noexcept
+		: buf_(buf)
+	{}
+
+	bundle_view(const osc_data_t *buf, size_t size) noexcept
+		: buf_(reinterpret_cast<const std::byte *>(buf), size)
+	{}
+
+	constexpr std::span<const std::byte>
+	data() const noexcept
+	{
+		return buf_;
+	}
+
+	// bundle header is well-formed
+	constexpr bool
+	valid() const noexcept
+	{
+		constexpr char header [8] = {'#', 'b', 'u', 'n', 'd', 'l', 'e', '\0'};
+
+		if(buf_.size() < 16)
+			return false;
+		for(size_t i = 0; i < 8; i++)
+			if(buf_[i] != std::byte(header[i]))
+				return false;
+		return true;
+	}
+
+	constexpr osc_time_t
+	time() const noexcept
+	{
+		return valid() ? detail::load64(buf_.data() + 8) : 0;
+	}
+
+	constexpr iterator
+	begin() const noexcept
+	{
+		return valid() ? iterator(buf_.subspan(16), false) : iterator();
+	}
+
+	constexpr iterator
+	end() const noexcept
+	{
+		return iterator();
+	}
+
+	constexpr nested_range
+	bundles() const noexcept
+	{
+		return nested_range(valid() ? buf_.subspan(16) : std::span<const std::byte>());
+	}
+
+private:
+	std::span<const std::byte> buf_;
+};
+
+constexpr bundle_view
+element::bundle() const noexcept
+{
+	return is_bundle() ? bundle_view(buf_) : bundle_view();
+}
+
+
+/*
+ * Growable packet builder.
+ *
+ * Encodes into a packet_buffer with inline storage of inline_size bytes,
+ * larger packets spill to heap buffers taken from a small thread-local pool
+ * of power-of-two size classes. Writes that do not fit grow the buffer and
+ * are retried, bundle and bundle item scopes patch their headers when they
+ * go out of scope. Scopes remember offsets, not pointers, as the buffer may
+ * move while growing. release() hands out the finished buffer, heap storage
+ * moves without copying.
+ */
+
+namespace detail {
+
+class buffer_pool
+{
+public:
+	static constexpr size_t min_size = 1024;
+	static constexpr size_t classes = 7; // 1K up to 64K
+	static constexpr size_t depth = 8; // cached buffers per class
+
+	// round size up to its class, sizes beyond the largest class are kept
+	static constexpr size_t
+	round(size_t size) noexcept
+	{
+		size_t cls = min_size;
+		while( (cls < size) && (cls < (min_size << (classes - 1))) )
+			cls <<= 1;
+		return (cls < size) ? size : cls;
+	}
+
+	// size must have been rounded
+	static std::byte *
+	acquire(size_t size) noexcept
+	{
+		const size_t cls = index(size);
+		if(cls < classes)
+		{
+			cache &c = local();
+			if(c.count[cls] > 0)
+				return c.free[cls][--c.count[cls]];
+		}
+
+		return static_cast<std::byte *>(std::malloc(size));
+	}
+
+	static void
+	release(std::byte *ptr, size_t size) noexcept
+	{
+		const size_t cls = index(size);
+		if(cls < classes)
+		{
+			cache &c = local();
+			if(c.count[cls] < depth)
+			{
+				c.free[cls][c.count[cls]++] = ptr;
+				return;
+			}
+		}
+
+		std::free(ptr);
+	}
+
+private:
+	struct cache
+	{
+		std::array<std::array<std::byte *, depth>, classes> free = {};
+		std::array<size_t, classes> count = {};
+
+		~cache()
+		{
+			for(size_t i = 0; i < classes; i++)
+				for(size_t j = 0; j < count[i]; j++)
+					std::free(free[i][j]);
+		}
+	};
+
+	static constexpr size_t
+	index(size_t size) noexcept
+	{
+		size_t cls = 0;
+		while( (cls < classes) && ((min_size << cls) != size) )
+			cls++;
+		return cls;
+	}
+
+	static cache &
+	local() noexcept
+	{
+		thread_local cache c;
+		return c;
+	}
+};
+
+} // namespace detail
+
+class packet_buffer
+{
+public:
+	static constexpr size_t inline_size = 512;
+
+	packet_buffer() noexcept = default;
+
+	packet_buffer(const packet_buffer &) = delete;
+	packet_buffer &operator=(const packet_buffer &) = delete;
+
+	packet_buffer(packet_buffer &&other) noexcept
+	{
+		take(other);
+	}
+
+	packet_buffer &
+	operator=(packet_buffer &&other) noexcept
+	{
+		if(this != &other)
+		{
+			free();
+			take(other);
+		}
+		return *this;
+	}
+
+	~packet_buffer()
+	{
+		free();
+	}
+
+	std::byte *
+	data() noexcept
+	{
+		return heap_ ? heap_ : inline_.data();
+	}
+
+	const std::byte *
+	data() const noexcept
+	{
+		return heap_ ? heap_ : inline_.data();
+	}
+
+	size_t
+	size() const noexcept
+	{
+		return size_;
+	}
+
+	size_t
+	capacity() const noexcept
+	{
+		return capacity_;
+	}
+
+	bool
+	is_inline() const noexcept
+	{
+		return heap_ == nullptr;
+	}
+
+	std::span<const std::byte>
+	span() const noexcept
+	{
+		return {data(), size_};
+	}
+
+	// grow to at least capacity, content is kept
+	bool
+	reserve(size_t capacity) noexcept
+	{
+		if(capacity <= capacity_)
+			return true;
+
+		capacity = detail::buffer_pool::round(capacity);
+		std::byte *heap = detail::buffer_pool::acquire(capacity);
+		if(!heap)
+			return false;
+
+		const size_t size = size_;
+		std::memcpy(heap, data(), size);
+		free();
+		heap_ = heap;
+		size_ = size;
+		capacity_ = capacity;
+
+		return true;
+	}
+
+	// size must not exceed capacity
+	void
+	resize(size_t size) noexcept
+	{
+		size_ = size;
+	}
+
+	void
+	clear() noexcept
+	{
+		size_ = 0;
+	}
+
+private:
+	void
+	free() noexcept
+	{
+		if(heap_)
+			detail::buffer_pool::release(heap_, capacity_);
+		heap_ = nullptr;
+		size_ = 0;
+		capacity_ = inline_size;
+	}
+
+	void
+	take(packet_buffer &other) noexcept
+	{
+		if(other.heap_)
+		{
+			heap_ = other.heap_;
+			capacity_ = other.capacity_;
+		}
+		else
+			std::memcpy(inline_.data(), other.inline_.data(), other.size_);
+		size_ = other.size_;
+
+		other.heap_ = nullptr;
+		other.size_ = 0;
+		other.capacity_ = inline_size;
+	}
+
+	std::byte *heap_ = nullptr;
+	size_t size_ = 0;
+	size_t capacity_ = inline_size;
+	alignas(8) std::array<std::byte, inline_size> inline_;
+};
+
+class packet_builder
+{
+public:
+	static constexpr size_t max_size = size_t(1) << 24; // stop growing here
+
+	class bundle_scope
+	{
+	public:
+		bundle_scope(const bundle_scope &) = delete;
+		bundle_scope &operator=(const bundle_scope &) = delete;
+
+		~bundle_scope()
+		{
+			builder_.end(offset_, osc_end_bundle);
+		}
+
+	private:
+		friend class packet_builder;
+
+		bundle_scope(packet_builder &builder, size_t offset) noexcept
+			: builder_(builder), offset_(offset)
+		{}
+
+		packet_builder &builder_;
+		size_t offset_;
+	};
+
+	class item_scope
+	{
+	public:
+		item_scope(const item_scope &) = delete;
+		item_scope &operator=(const item_scope &) = delete;
+
+		~item_scope()
+		{
+			builder_.end(offset_, osc_end_bundle_item);
+		}
+
+	private:
+		friend class packet_builder;
+
+		item_scope(packet_builder &builder, size_t offset) noexcept
+			: builder_(builder), offset_(offset)
+		{}
+
+		packet_builder &builder_;
+		size_t offset_;
+	};
+
+	packet_builder() noexcept = default;
+
+	packet_builder(const packet_builder &) = delete;
+	packet_builder &operator=(const packet_builder &) = delete;
+
+	// start bundle, it ends when the returned scope goes out of scope
+	[[nodiscard]] bundle_scope
+	bundle(osc_time_t t) noexcept
+	{
+		const size_t offset = buf_.size();
+		write([t](osc_data_t *ptr, const osc_data_t *end) {
+			osc_data_t *bndl;
+			return osc_start_bundle(ptr, end, t, &bndl);
+		});
+		return bundle_scope(*this, offset);
+	}
+
+	// start bundle item, it ends when the returned scope goes out of scope
+	[[nodiscard]] item_scope
+	item() noexcept
+	{
+		const size_t offset = buf_.size();
+		write([](osc_data_t *ptr, const osc_data_t *end) {
+			osc_data_t *itm;
+			return osc_start_bundle_item(ptr, end, &itm);
+		});
+		return item_scope(*this, offset);
+	}
+
+	// arguments as for osc_set_vararg
+	template<typename... Args>
+	bool
+	message(const char *path, const char *fmt, Args... args) noexcept
+	{
+		static_assert((std::is_trivially_copyable_v<Args> && ...),
+			"arguments must be scalars or pointers");
+
+		if(!osc_check_fmt(fmt, 0)) // only overflow may fail from here on
+		{
+			failed_ = true;
+			return false;
+		}
+
+		return write([=](osc_data_t *ptr, const osc_data_t *end) {
+			return osc_set_vararg(ptr, end, path, fmt, args...);
+		});
+	}
+
+	// message wrapped into its own bundle item
+	template<typename... Args>
+	bool
+	item_message(const char *path, const char *fmt, Args... args) noexcept
+	{
+		item_scope itm = item();
+		return message(path, fmt, args...);
+	}
+
+	// append preformatted bytes
+	bool
+	append(std::span<const std::byte> raw) noexcept
+	{
+		return write([raw](osc_data_t *ptr, const osc_data_t *end) -> osc_data_t * {
+			if(ptr + raw.size() > end)
+				return nullptr;
+			std::memcpy(ptr, raw.data(), raw.size());
+			return ptr + raw.size();
+		});
+	}
+
+	// no write has failed since last clear
+	bool
+	ok() const noexcept
+	{
+		return !failed_;
+	}
+
+	std::span<const std::byte>
+	data() const noexcept
+	{
+		return buf_.span();
+	}
+
+	size_t
+	size() const noexcept
+	{
+		return buf_.size();
+	}
+
+	const packet_buffer &
+	buffer() const noexcept
+	{
+		return buf_;
+	}
+
+	void
+	clear() noexcept
+	{
+		buf_.clear();
+		failed_ = false;
+	}
+
+	// move finished packet out, builder starts over empty
+	packet_buffer
+	release() noexcept
+	{
+		failed_ = false;
+		return std::move(buf_);
+	}
+
+private:
+	osc_data_t *
+	base() noexcept
+	{
+		return reinterpret_cast<osc_data_t *>(buf_.data());
+	}
+
+	// run f on the free space, grow and retry until it fits
+	template<typename F>
+	bool
+	write(F &&f) noexcept
+	{
+		if(failed_)
+			return false;
+
+		for(;;)
+		{
+			osc_data_t *ptr = f(base() + buf_.size(), base() + buf_.capacity());
+			if(ptr)
+			{
+				buf_.resize(ptr - base());
+				return true;
+			}
+
+			const size_t capacity = buf_.capacity() * 2;
+			if( (capacity > max_size) || !buf_.reserve(capacity) )
+			{
+				failed_ = true;
+				return false;
+			}
+		}
+	}
+
+	void
+	end(size_t offset, osc_data_t *(*fn)(osc_data_t *, const osc_data_t *,
+		osc_data_t *)) noexcept
+	{
+		if(failed_)
+			return;
+
+		osc_data_t *ptr = fn(base() + buf_.size(), base() + buf_.capacity(),
+			base() + offset);
+		buf_.resize(ptr - base());
+	}
+
+	packet_buffer buf_;
+	bool failed_ = false;
+};
+
+/*
+ * Compile-time method tables.
+ *
+ * method_table takes a list of method<path, format, handler> entries known
+ * at build time and searches, at compile time, a seed for which a seeded
+ * FNV-1a hash maps all distinct paths to distinct slots of a power-of-two
+ * table. Dispatch costs one hash over the path, one comparison with the
+ * single candidate and a direct call: handlers are template arguments and
+ * inlined, there are no osc_method_cb_t pointers. Semantics follow
+ * osc_dispatch_method: a format of "*" matches any format, entries with
+ * the same path are tried in order until a handler returns true, handlers
+ * returning void always stop. Patterns in incoming paths are not expanded,
+ * paths are matched exactly.
+ *
+ * A path of "*" takes the place of a NULL path: such entries are tried in
+ * order for every message no entry of its own path took, i.e. after the
+ * hashed entries rather than at their position in the list. There are no
+ * bundle_in and bundle_out callbacks, bundles are only walked.
+ *
+ * Handlers are called as handler(time, message_view, ctx...) with the
+ * context arguments passed to dispatch.
+ */
+
+template<size_t N>
+struct fixed_string
+{
+	char chars [N] = {};
+
+	constexpr fixed_string(const char (&str)[N]) noexcept
+	{
+		for(size_t i = 0; i < N; i++)
+			chars[i] = str[i];
+	}
+
+	constexpr std::string_view
+	view() const noexcept
+	{
+		return {chars, N - 1};
+	}
+};
+
+template<fixed_string Path, fixed_string Format, auto Handler>
+struct method
+{
+	static constexpr std::string_view path = Path.view();
+	static constexpr std::string_view format = Format.view();
+	static constexpr bool any_path = (path == "*");
+	static constexpr bool any_format = (format == "*");
+	static constexpr auto handler = Handler;
+};
+
+namespace detail {
+
+constexpr uint32_t
+seeded_hash(std::string_view str, uint32_t seed) noexcept
+{
+	uint32_t hash = seed;
+	for(const char c : str)
+	{
+		hash ^= uint8_t(c);
+		hash *= 0x01000193;
+	}
+	return hash ^ (hash >> 16); // fold high bits into the slot bits
+}
+
+} // namespace detail
+
+template<typename... Methods>
+class method_table
+{
+public:
+	static constexpr size_t count = sizeof...(Methods);
+
+	// dispatch a single message, returns whether a handler took it
+	template<typename... Ctx>
+	static bool
+	dispatch(osc_time_t time, const message_view &msg, Ctx &...ctx)
+	{
+		if constexpr(count == 0)
+			return false;
+		else
+		{
+			const std::string_view path = msg.path();
+			if(path.empty())
+				return false;
+
+			const uint32_t slot = slots_[detail::seeded_hash(path, layout_.seed)
+				& (layout_.size - 1)];
+			if( slot && (path == group_paths_[slot - 1])
+					&& call_group(std::make_index_sequence<groups_>(), slot - 1, time,
+						msg, ctx...) )
+				return true;
+
+			return call_entries<any_group_>(std::make_index_sequence<count>(),
+				time, msg, ctx...);
+		}
+	}
+
+	// dispatch a message or every message of a bundle, nested bundles
+	// included, returns number of messages taken
+	template<typename... Ctx>
+	static size_t
+	dispatch(std::span<const std::byte> packet, Ctx &...ctx)
+	{
+		if(packet.empty())
+			return 0;
+
+		switch(packet[0])
+		{
+			case std::byte{'/'}:
+				return dispatch(OSC_IMMEDIATE, message_view(packet), ctx...);
+			case std::byte{'#'}:
+				return dispatch_bundle(bundle_view(packet), ctx...);
+			default:
+				return 0;
+		}
+	}
+
+	template<typename... Ctx>
+	static size_t
+	dispatch(const osc_data_t *buf, size_t size, Ctx &...ctx)
+	{
+		return dispatch(std::span<const std::byte>(
+			reinterpret_cast<const std::byte *>(buf), size), ctx...);
+	}
+
+	// hash table size and seed, for inspection
+	static constexpr size_t
+	table_size() noexcept
+	{
+		return layout_.size;
+	}
+
+	static constexpr uint32_t
+	seed() noexcept
+	{
+		return layout_.seed;
+	}
+
+private:
+	using entries = std::tuple<Methods...>;
+
+	static constexpr std::array<std::string_view, count> paths_ = {Methods::path...};
+	static constexpr std::array<bool, count> any_path_ = {Methods::any_path...};
+	static constexpr size_t any_group_ = SIZE_MAX; // of "*" entries, not hashed
+
+	// index of distinct path per entry, in order of first appearance
+	static constexpr auto group_of_ = [] {
+		std::array<size_t, count> group = {};
+		size_t n = 0;
+		for(size_t i = 0; i < count; i++)
+		{
+			if(any_path_[i])
+			{
+				group[i] = any_group_;
+				continue;
+			}
+
+			group[i] = n;
+			for(size_t j = 0; j < i; j++)
+				if(paths_[j] == paths_[i])
+				{
+					group[i] = group[j];
+					break;
+				}
+			if(group[i] == n)
+				n++;
+		}
+		return group;
+	}();
+
+	static constexpr size_t groups_ = [] {
+		size_t n = 0;
+		for(size_t i = 0; i < count; i++)
+			if( !any_path_[i] && (group_of_[i] + 1 > n) )
+				n = group_of_[i] + 1;
+		return n;
+	}();
+
+	static constexpr auto group_paths_ = [] {
+		std::array<std::string_view, groups_> paths = {};
+		for(size_t i = 0; i < count; i++)
+			if(!any_path_[i])
+				paths[group_of_[i]] = paths_[i];
+		return paths;
+	}();
+
+	struct layout
+	{
+		size_t size;
+		uint32_t seed;
+	};
+
+	static constexpr bool
+	perfect(size_t size, uint32_t seed) noexcept
+	{
+		for(size_t i = 0; i < groups_; i++)
+			for(size_t j = 0; j < i; j++)
+				if( ((detail::seeded_hash(group_paths_[i], seed)
+						^ detail::seeded_hash(group_paths_[j], seed)) & (size - 1)) == 0)
+					return false;
+		return true;
+	}
+
+	// smallest table of at least twice the paths with a seed among the
+	// first few tried, grow otherwise
+	static constexpr layout layout_ = [] {
+		size_t size = 1;
+		while(size < 2*groups_)
+			size <<= 1;
+
+		for( ; ; size <<= 1)
+		{
+			uint32_t seed = 0x811c9dc5;
+			for(unsigned i = 0; i < 256; i++, seed = seed*0x9e3779b9 + 1)
+				if(perfect(size, seed))
+					return layout{size, seed};
+		}
+	}();
+
+	static constexpr auto slots_ = [] {
+		std::array<uint32_t, layout_.size> slots = {}; // group + 1, 0 if empty
+		for(size_t g = 0; g < groups_; g++)
+			slots[detail::seeded_hash(group_paths_[g], layout_.seed)
+				& (layout_.size - 1)] = g + 1;
+		return slots;
+	}();
+
+	template<size_t I, typename... Ctx>
+	static bool
+	call(osc_time_t time, const message_view &msg, Ctx &...ctx)
+	{
+		using entry = std::tuple_element_t<I, entries>;
+
+		if constexpr(!entry::any_format)
+		{
+			if(msg.format() != entry::format)
+				return false;
+		}
+
+		if constexpr(std::is_void_v<decltype(entry::handler(time, msg, ctx...))>)
+		{
+			entry::handler(time, msg, ctx...);
+			return true;
+		}
+		else
+			return bool(entry::handler(time, msg, ctx...));
+	}
+
+	// try entries of group G in order, any_group_ for the "*" entries
+	template<size_t G, size_t... I, typename... Ctx>
+	static bool
+	call_entries(std::index_sequence<I...>, osc_time_t time,
+		const message_view &msg, Ctx &...ctx)
+	{
+		return ( ((group_of_[I] == G) && call<I>(time, msg, ctx...)) || ... );
+	}
+
+	// jump to group, the fold over constant indices compiles to a switch
+	template<size_t... G, typename... Ctx>
+	static bool
+	call_group(std::index_sequence<G...>, size_t group, osc_time_t time,
+		const message_view &msg, Ctx &...ctx)
+	{
+		bool taken = false;
+		( ((group == G) && (taken = call_entries<G>(std::make_index_sequence<count>(),
+			time, msg, ctx...), true)) || ... );
+		return taken;
+	}
+
+	template<typename... Ctx>
+	static size_t
+	dispatch_bundle(const bundle_view &bndl, Ctx &...ctx)
+	{
+		size_t taken = 0;
+		for(const element &elmnt : bndl)
+		{
+			if(elmnt.is_message())
+				taken += dispatch(bndl.time(), elmnt.message(), ctx...);
+			else if(elmnt.is_bundle())
+				taken += dispatch_bundle(elmnt.bundle(), ctx...);
+		}
+		return taken;
+	}
+};
+
+} // namespace osc
+
+#endif /* _LIB_OSC_HPP_ */
@@ -0,0 +1,212 @@
+/*
+ * Copyright (c) 2015 Hanspeter Portner (dev@open-music-kontrollers.ch)
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the Artistic License 2.0 as published by
+ * The Perl Foundation.
+ *
+ * This source is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * Artistic License 2.0 for more details.
+ *
+ * You should have received a copy of the Artistic License 2.0
+ * along the source as a COPYING file. If not, obtain it from
+ * http://www.perlfoundation.org/artistic_license_2_0.
+ */
+
+#ifndef _LIB_OSC_BATCH_H_
+#define _LIB_OSC_BATCH_H_
+
+#include "osc.h"
+
+/*
+ * Deadline batching of outgoing messages.
+ *
+ * Messages are appended as items to an open bundle in a caller-provided
+ * buffer, its size is the largest packet to send, e.g. the path MTU. The
+ * bundle is handed to the send callback when a message no longer fits, or
+ * by osc_batch_poll once the oldest message has waited for window. A
+ * bundle holding a single message with immediate timetag is sent as bare
+ * message. Times are monotonic and in a unit of the caller's choice, the
+ * latency counters are in the same unit.
+ */
+
+typedef void (*osc_batch_send_cb_t)(const osc_data_t *buf, size_t size,
+	void *data);
+
+typedef struct _osc_batch_t osc_batch_t;
+
+struct _osc_batch_t {
+	osc_data_t *buf;
+	const osc_data_t *end;
+	osc_data_t *ptr;
+	osc_time_t time; // timetag of next bundle
+	uint64_t window;
+
+	osc_batch_send_cb_t send;
+	void *data;
+
+	// open bundle
+	uint32_t count;
+	uint64_t first; // enqueue time of oldest message
+	uint64_t enqueued; // sum of enqueue times
+
+	// counters
+	uint32_t flushes_full;
+	uint32_t flushes_deadline;
+	uint32_t flushes_forced;
+	uint64_t messages;
+	uint64_t latency_sum; // time spent queued, summed over messages
+	uint64_t latency_max;
+	uint32_t too_large; // messages not fitting an empty bundle
+};
+
+static inline void
+osc_batch_init(osc_batch_t *batch, osc_data_t *buf, size_t size, osc_time_t time,
+	uint64_t window, osc_batch_send_cb_t send, void *data)
+{
+	memset(batch, 0, sizeof(osc_batch_t));
+
+	batch->buf = buf;
+	batch->end = buf + size;
+	batch->time = time;
+	batch->window = window;
+	batch->send = send;
+	batch->data = data;
+}
+
+static inline void
+_osc_batch_flush(osc_batch_t *batch, uint64_t now)
+{
+	if(!batch->count)
+		return;
+
+	const uint64_t latency = batch->count*now - batch->enqueued;
+	batch->latency_sum += latency;
+	if(now - batch->first > batch->latency_max)
+		batch->latency_max = now - batch->first;
+	batch->messages += batch->count;
+
+	if( (batch->count == 1) && (batch->time == OSC_IMMEDIATE) )
+	{
+		// skip bundle header and item size
+		batch->send(batch->buf + 20, batch->ptr - (batch->buf + 20), batch->data);
+	}
+	else
+	{
+		osc_data_t *ptr = osc_end_bundle(batch->ptr, batch->end, batch->buf);
+		batch->send(batch->buf, ptr - batch->buf, batch->data);
+	}
+
+	batch->count = 0;
+	batch->enqueued = 0;
+}
+
+// send open bundle now
+static inline void
+osc_batch_flush(osc_batch_t *batch, uint64_t now)
+{
+	if(batch->count)
+		batch->flushes_forced++;
+	_osc_batch_flush(batch, now);
+}
+
+// flush when deadline has passed, returns deadline of open bundle or 0
+static inline uint64_t
+osc_batch_poll(osc_batch_t *batch, uint64_t now)
+{
+	if(!batch->count)
+		return 0;
+
+	const uint64_t deadline = batch->first + batch->window;
+	if(now < deadline)
+		return deadline;
+
+	batch->flushes_deadline++;
+	_osc_batch_flush(batch, now);
+
+	return 0;
+}
+
+// change timetag for following messages, flushes open bundle if it differs
+static inline void
+osc_batch_time(osc_batch_t *batch, uint64_t now, osc_time_t time)
+{
+	if(time == batch->time)
+		return;
+
+	if(batch->count)
+		batch->flushes_forced++;
+	_osc_batch_flush(batch, now);
+	batch->time = time;
+}
+
+static inline osc_data_t *
+_osc_batch_item(osc_batch_t *batch, const char *path, const char *fmt,
+	va_list args)
+{
+	osc_data_t *ptr = batch->ptr;
+	osc_data_t *itm;
+
+	if(!batch->count)
+	{
+		osc_data_t *bndl;
+		ptr = osc_start_bundle(batch->buf, batch->end, batch->time, &bndl);
+	}
+
+	ptr = osc_start_bundle_item(ptr, batch->end, &itm);
+	ptr = osc_set_varlist(ptr, batch->end, path, fmt, args);
+	ptr = osc_end_bundle_item(ptr, batch->end, itm);
+
+	return ptr;
+}
+
+// queue message, returns 0 if it does not fit into an empty bundle
+static inline int
+osc_batch_varlist(osc_batch_t *batch, uint64_t now, const char *path,
+	const char *fmt, va_list args)
+{
+	va_list copy;
+	va_copy(copy, args);
+	osc_data_t *ptr = _osc_batch_item(batch, path, fmt, copy);
+	va_end(copy);
+
+	if(!ptr && batch->count) // full, send and retry with empty bundle
+	{
+		batch->flushes_full++;
+		_osc_batch_flush(batch, now);
+
+		va_copy(copy, args);
+		ptr = _osc_batch_item(batch, path, fmt, copy);
+		va_end(copy);
+	}
+
+	if(!ptr)
+	{
+		batch->too_large++;
+		return 0;
+	}
+
+	if(!batch->count)
+		batch->first = now;
+	batch->count++;
+	batch->enqueued += now;
+	batch->ptr = ptr;
+
+	return 1;
+}
+
+static inline int
+osc_batch_vararg(osc_batch_t *batch, uint64_t now, const char *path,
+	const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	const int res = osc_batch_varlist(batch, now, path, fmt, args);
+	va_end(args);
+
+	return res;
+}
+
+#endif /* _LIB_OSC_BATCH_H_ */
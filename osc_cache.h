@@ -0,0 +1,253 @@
+/*
+ * Copyright (c) 2015 Hanspeter Portner (dev@open-music-kontrollers.ch)
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the Artistic License 2.0 as published by
+ * The Perl Foundation.
+ *
+ * This source is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * Artistic License 2.0 for more details.
+ *
+ * You should have received a copy of the Artistic License 2.0
+ * along the source as a COPYING file. If not, obtain it from
+ * http://www.perlfoundation.org/artistic_license_2_0.
+ */
+
+#ifndef _LIB_OSC_CACHE_H_
+#define _LIB_OSC_CACHE_H_
+
+#include "osc.h"
+
+/*
+ * Dispatch result cache.
+ *
+ * Remembers which entries of a method table match a given raw path and
+ * format, including catch-all entries with NULL path or format, so repeated
+ * pairs skip re-evaluating the whole table. The cache is bound to one
+ * method table, call osc_cache_invalidate whenever that table changes.
+ * Pairs with keys longer than OSC_CACHE_KEY_MAX or more than
+ * OSC_CACHE_MATCH_MAX matches fall back to the plain table walk.
+ *
+ * Like osc_dispatch_method, matching compares paths literally, there is no
+ * OSC address pattern matching. A path containing '*', '?', '[' or '{' is
+ * cached as its own key and only hits methods registered with exactly that
+ * string or with a NULL path, it is not expanded against the table.
+ */
+
+#ifndef OSC_CACHE_SIZE
+#	define OSC_CACHE_SIZE 256 // must be a power of two
+#endif
+
+#ifndef OSC_CACHE_KEY_MAX
+#	define OSC_CACHE_KEY_MAX 128
+#endif
+
+#ifndef OSC_CACHE_MATCH_MAX
+#	define OSC_CACHE_MATCH_MAX 8
+#endif
+
+#define OSC_CACHE_PROBE 4
+
+typedef struct _osc_cache_entry_t osc_cache_entry_t;
+typedef struct _osc_cache_t osc_cache_t;
+
+struct _osc_cache_entry_t {
+	uint32_t gen; // entry is stale if it differs from cache generation
+	uint32_t hash;
+	uint16_t keylen;
+	uint16_t nmatch; // OSC_CACHE_MATCH_MAX + 1 for too many matches
+	uint16_t match [OSC_CACHE_MATCH_MAX];
+	osc_data_t key [OSC_CACHE_KEY_MAX];
+};
+
+struct _osc_cache_t {
+	const osc_method_t *methods;
+	uint32_t gen;
+
+	uint32_t hits;
+	uint32_t misses;
+
+	osc_cache_entry_t entries [OSC_CACHE_SIZE];
+};
+
+// bind cache to a new or changed method table
+static inline void
+osc_cache_invalidate(osc_cache_t *cache, const osc_method_t *methods)
+{
+	cache->methods = methods;
+	cache->gen++;
+
+	if(cache->gen == 0) // wrapped around, clear for good
+	{
+		unsigned i;
+		for(i=0; i<OSC_CACHE_SIZE; i++)
+			cache->entries[i].gen = 0;
+		cache->gen = 1;
+	}
+}
+
+static inline void
+osc_cache_init(osc_cache_t *cache, const osc_method_t *methods)
+{
+	unsigned i;
+	for(i=0; i<OSC_CACHE_SIZE; i++)
+		cache->entries[i].gen = 0;
+
+	cache->gen = 0;
+	cache->hits = 0;
+	cache->misses = 0;
+
+	osc_cache_invalidate(cache, methods);
+}
+
+// evaluate method table for path and format, fill entry
+static inline void
+_osc_cache_fill(osc_cache_t *cache, osc_cache_entry_t *entry, const char *path,
+	const char *fmt)
+{
+	entry->nmatch = 0;
+
+	const osc_method_t *meth;
+	for(meth=cache->methods; meth->cb; meth++)
+	{
+		if(  (!meth->path || !strcmp(meth->path, path))
+			&& (!meth->fmt || !strcmp(meth->fmt, fmt+1)) )
+		{
+			if(entry->nmatch == OSC_CACHE_MATCH_MAX)
+			{
+				entry->nmatch++; // too many, not cacheable
+				return;
+			}
+			entry->match[entry->nmatch++] = meth - cache->methods;
+		}
+	}
+}
+
+// get entry for raw path and format, NULL if not cacheable
+static inline const osc_cache_entry_t *
+_osc_cache_lookup(osc_cache_t *cache, const osc_data_t *key, size_t keylen,
+	const char *path, const char *fmt)
+{
+	if(keylen > OSC_CACHE_KEY_MAX)
+		return NULL;
+
+	const uint32_t hash = osc_hash(key, keylen);
+	osc_cache_entry_t *victim = &cache->entries[hash & (OSC_CACHE_SIZE - 1)];
+
+	unsigned i;
+	for(i=0; i<OSC_CACHE_PROBE; i++)
+	{
+		osc_cache_entry_t *entry = &cache->entries[(hash + i) & (OSC_CACHE_SIZE - 1)];
+
+		if(entry->gen != cache->gen) // stale or free
+		{
+			victim = entry;
+			break;
+		}
+
+		if( (entry->hash == hash) && (entry->keylen == keylen)
+			&& !memcmp(entry->key, key, keylen) )
+		{
+			cache->hits++;
+			return entry->nmatch <= OSC_CACHE_MATCH_MAX ? entry : NULL;
+		}
+	}
+
+	// miss, reuse free slot or evict the home slot
+	cache->misses++;
+	victim->gen = cache->gen;
+	victim->hash = hash;
+	victim->keylen = keylen;
+	memcpy(victim->key, key, keylen);
+	_osc_cache_fill(cache, victim, path, fmt);
+
+	return victim->nmatch <= OSC_CACHE_MATCH_MAX ? victim : NULL;
+}
+
+static inline void
+_osc_cache_dispatch_message(osc_cache_t *cache, osc_time_t time,
+	const osc_data_t *buf, size_t size, void *data)
+{
+	const osc_data_t *ptr = buf;
+
+	const char *path = NULL;
+	const char *fmt = NULL;
+
+	ptr = osc_get_path(ptr, &path);
+	ptr = osc_get_fmt(ptr, &fmt);
+
+	const osc_cache_entry_t *entry = _osc_cache_lookup(cache, buf, ptr - buf,
+		path, fmt);
+	if(!entry)
+	{
+		_osc_method_dispatch_message(time, buf, size, cache->methods, data);
+		return;
+	}
+
+	unsigned i;
+	for(i=0; i<entry->nmatch; i++)
+	{
+		const osc_method_t *meth = &cache->methods[entry->match[i]];
+
+		if(meth->cb(time, path, fmt+1, ptr, size-(ptr-buf), data))
+			break;
+	}
+}
+
+static inline void
+_osc_cache_dispatch_bundle(osc_cache_t *cache, const osc_data_t *buf,
+	size_t size, osc_bundle_in_cb_t bundle_in, osc_bundle_out_cb_t bundle_out,
+	void *data)
+{
+	const osc_data_t *end = buf + size;
+
+	osc_time_t time;
+	const osc_data_t *ptr = osc_get_bundle(buf, &time); // skip bundle header
+	if(!ptr)
+		return;
+
+	if(bundle_in)
+		bundle_in(time, data);
+
+	while(ptr < end)
+	{
+		int32_t len = be32toh(*((const int32_t *)ptr));
+		ptr += sizeof(int32_t);
+		switch(*ptr)
+		{
+			case '#':
+				_osc_cache_dispatch_bundle(cache, ptr, len, bundle_in, bundle_out,
+					data);
+				break;
+			case '/':
+				_osc_cache_dispatch_message(cache, time, ptr, len, data);
+				break;
+		}
+		ptr += len;
+	}
+
+	if(bundle_out)
+		bundle_out(time, data);
+}
+
+// like osc_dispatch_method on the table the cache is bound to
+static inline void
+osc_cache_dispatch_method(osc_cache_t *cache, const osc_data_t *buf,
+	size_t size, osc_bundle_in_cb_t bundle_in, osc_bundle_out_cb_t bundle_out,
+	void *data)
+{
+	switch(*buf)
+	{
+		case '#':
+			_osc_cache_dispatch_bundle(cache, buf, size, bundle_in, bundle_out,
+				data);
+			break;
+		case '/':
+			_osc_cache_dispatch_message(cache, OSC_IMMEDIATE, buf, size, data);
+			break;
+	}
+}
+
+#endif /* _LIB_OSC_CACHE_H_ */
@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2015 Hanspeter Portner (dev@open-music-kontrollers.ch)
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the Artistic License 2.0 as published by
+ * The Perl Foundation.
+ *
+ * This source is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * Artistic License 2.0 for more details.
+ *
+ * You should have received a copy of the Artistic License 2.0
+ * along the source as a COPYING file. If not, obtain it from
+ * http://www.perlfoundation.org/artistic_license_2_0.
+ */
+
+#ifndef _LIB_OSC_CHECK_H_
+#define _LIB_OSC_CHECK_H_
+
+#include "osc.h"
+#include "osc_pool.h"
+
+/*
+ * Batch validation.
+ *
+ * Checks an array of received packets, e.g. from one recvmmsg call, with
+ * osc_check_packet_reason, so results are exactly those of
+ * osc_check_packet. While one packet is checked, the leading cache lines of
+ * the packet OSC_CHECK_AHEAD places further are prefetched, which overlaps
+ * their memory latency with useful work. Valid packets are marked in a
+ * bitmap of 64-bit words, one bit per packet, reasons are optional.
+ * osc_check_batch_parallel splits large batches into jobs of OSC_CHECK_JOB
+ * packets for a worker pool, each job owns whole bitmap words.
+ */
+
+#ifndef OSC_CHECK_AHEAD
+#	define OSC_CHECK_AHEAD 4
+#endif
+
+#ifndef OSC_CHECK_JOB
+#	define OSC_CHECK_JOB 256 // must be a multiple of 64
+#endif
+
+#if defined(__GNUC__)
+#	define OSC_PREFETCH(ptr) __builtin_prefetch(ptr)
+#else
+#	define OSC_PREFETCH(ptr)
+#endif
+
+typedef struct _osc_check_item_t osc_check_item_t;
+
+struct _osc_check_item_t {
+	const osc_data_t *buf;
+	size_t size;
+};
+
+static inline void
+_osc_check_prefetch(const osc_check_item_t *item)
+{
+	// path, format and first arguments
+	OSC_PREFETCH(item->buf);
+	if(item->size > 64)
+		OSC_PREFETCH(item->buf + 64);
+}
+
+// check items from to to, from must be a multiple of 64
+static inline unsigned
+_osc_check_range(const osc_check_item_t *items, unsigned from, unsigned to,
+	uint64_t *valid, osc_check_t *reasons)
+{
+	unsigned nvalid = 0;
+	unsigned i;
+
+	for(i=from; i<to; i+=64)
+		valid[i / 64] = 0;
+
+	for(i=from; (i<to) && (i<from + OSC_CHECK_AHEAD); i++)
+		_osc_check_prefetch(&items[i]);
+
+	for(i=from; i<to; i++)
+	{
+		if(i + OSC_CHECK_AHEAD < to)
+			_osc_check_prefetch(&items[i + OSC_CHECK_AHEAD]);
+
+		const osc_check_t reason = items[i].size
+			? osc_check_packet_reason(items[i].buf, items[i].size)
+			: OSC_CHECK_TYPE;
+
+		if(reasons)
+			reasons[i] = reason;
+
+		if(reason == OSC_CHECK_OK)
+		{
+			valid[i / 64] |= 1ULL << (i % 64);
+			nvalid++;
+		}
+	}
+
+	return nvalid;
+}
+
+// valid must hold (n + 63) / 64 words, reasons n entries or be NULL,
+// returns number of valid packets
+static inline unsigned
+osc_check_batch(const osc_check_item_t *items, unsigned n, uint64_t *valid,
+	osc_check_t *reasons)
+{
+	return _osc_check_range(items, 0, n, valid, reasons);
+}
+
+typedef struct _osc_check_job_t osc_check_job_t;
+
+struct _osc_check_job_t {
+	const osc_check_item_t *items;
+	unsigned n;
+	uint64_t *valid;
+	osc_check_t *reasons;
+	atomic_uint nvalid;
+};
+
+static inline void
+_osc_check_job(unsigned job, void *data)
+{
+	osc_check_job_t *ctx = (osc_check_job_t *)data;
+	const unsigned from = job * OSC_CHECK_JOB;
+	const unsigned to = (from + OSC_CHECK_JOB < ctx->n) ? from + OSC_CHECK_JOB : ctx->n;
+
+	const unsigned nvalid = _osc_check_range(ctx->items, from, to, ctx->valid,
+		ctx->reasons);
+	atomic_fetch_add_explicit(&ctx->nvalid, nvalid, memory_order_relaxed);
+}
+
+// same as osc_check_batch, with batches larger than OSC_CHECK_JOB spread
+// over pool
+static inline unsigned
+osc_check_batch_parallel(osc_pool_t *pool, const osc_check_item_t *items,
+	unsigned n, uint64_t *valid, osc_check_t *reasons)
+{
+	if(n <= OSC_CHECK_JOB)
+		return osc_check_batch(items, n, valid, reasons);
+
+	osc_check_job_t ctx = {
+		.items = items,
+		.n = n,
+		.valid = valid,
+		.reasons = reasons
+	};
+	atomic_init(&ctx.nvalid, 0);
+
+	osc_pool_run(pool, (n + OSC_CHECK_JOB - 1) / OSC_CHECK_JOB, _osc_check_job, &ctx);
+
+	return atomic_load_explicit(&ctx.nvalid, memory_order_relaxed);
+}
+
+#endif /* _LIB_OSC_CHECK_H_ */
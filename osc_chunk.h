@@ -0,0 +1,331 @@
+/*
+ * Copyright (c) 2015 Hanspeter Portner (dev@open-music-kontrollers.ch)
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the Artistic License 2.0 as published by
+ * The Perl Foundation.
+ *
+ * This source is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * Artistic License 2.0 for more details.
+ *
+ * You should have received a copy of the Artistic License 2.0
+ * along the source as a COPYING file. If not, obtain it from
+ * http://www.perlfoundation.org/artistic_license_2_0.
+ */
+
+#ifndef _LIB_OSC_CHUNK_H_
+#define _LIB_OSC_CHUNK_H_
+
+#include "osc.h"
+#include "osc_batch.h"
+
+/*
+ * Chunked blob transfer.
+ *
+ * Large blobs travel as plain OSC messages OSC_CHUNK_PATH with format
+ * OSC_CHUNK_FMT: transfer id, total size, chunk size, offset and the chunk
+ * payload as blob. The receiver copies each payload straight to its final
+ * place in a caller-provided buffer, chunks may arrive in any order and
+ * more than once. A bitmap with one bit per chunk tracks progress, missing
+ * ranges can be queried for retransmission and a callback fires once the
+ * transfer is complete. A chunk with another transfer id starts over and
+ * reuses the buffer. The sender queues chunks into an osc_batch_t,
+ * paced by a token bucket, and can restart on any range.
+ */
+
+#define OSC_CHUNK_PATH "/chunk"
+#define OSC_CHUNK_FMT "ihihb"
+
+typedef void (*osc_chunk_complete_cb_t)(int32_t id, uint8_t *buf, uint64_t size,
+	void *data);
+
+typedef struct _osc_chunk_rx_t osc_chunk_rx_t;
+typedef struct _osc_chunk_tx_t osc_chunk_tx_t;
+
+struct _osc_chunk_rx_t {
+	uint8_t *dst;
+	uint64_t capacity;
+	uint32_t *bitmap;
+	uint32_t nbits;
+
+	osc_chunk_complete_cb_t complete;
+	void *data;
+
+	// current transfer
+	int active;
+	int32_t id;
+	uint64_t total;
+	uint32_t chunk;
+	uint32_t nchunks;
+	uint32_t received;
+
+	uint32_t duplicates;
+	uint32_t rejected; // not fitting or inconsistent with current transfer
+};
+
+struct _osc_chunk_tx_t {
+	int32_t id;
+	const uint8_t *src;
+	uint64_t total;
+	uint32_t chunk;
+
+	uint64_t offset; // next chunk to send
+	uint64_t until;
+
+	// token bucket, in payload bytes
+	uint64_t rate; // per second
+	uint64_t burst;
+	uint64_t tokens;
+	uint64_t credit; // refill remainder, in bytes times nanoseconds
+	uint64_t last; // in nanoseconds
+};
+
+// bitmap must hold nwords words, i.e. up to nwords*32 chunks per transfer
+static inline void
+osc_chunk_rx_init(osc_chunk_rx_t *rx, uint8_t *dst, uint64_t capacity,
+	uint32_t *bitmap, uint32_t nwords, osc_chunk_complete_cb_t complete, void *data)
+{
+	memset(rx, 0, sizeof(osc_chunk_rx_t));
+
+	rx->dst = dst;
+	rx->capacity = capacity;
+	rx->bitmap = bitmap;
+	rx->nbits = nwords * 32;
+	rx->complete = complete;
+	rx->data = data;
+}
+
+static inline int
+_osc_chunk_rx_start(osc_chunk_rx_t *rx, int32_t id, uint64_t total, uint32_t chunk)
+{
+	if(!chunk || (total > rx->capacity) )
+		return 0;
+
+	const uint64_t nchunks = (total + chunk - 1) / chunk;
+	if(nchunks > rx->nbits)
+		return 0;
+
+	rx->active = 1;
+	rx->id = id;
+	rx->total = total;
+	rx->chunk = chunk;
+	rx->nchunks = nchunks;
+	rx->received = 0;
+	memset(rx->bitmap, 0, (nchunks + 31) / 32 * sizeof(uint32_t));
+
+	return 1;
+}
+
+// arguments of one chunk message, returns 1 if the chunk was accepted
+static inline int
+osc_chunk_rx_args(osc_chunk_rx_t *rx, const osc_data_t *buf, size_t size)
+{
+	if(size < 28) // four integers and blob size
+		return 0;
+
+	int32_t id;
+	int64_t total;
+	int32_t chunk;
+	int64_t offset;
+	osc_blob_t blob;
+
+	buf = osc_get_int32(buf, &id);
+	buf = osc_get_int64(buf, &total);
+	buf = osc_get_int32(buf, &chunk);
+	buf = osc_get_int64(buf, &offset);
+	if( (total < 0) || (chunk <= 0) || (offset < 0) )
+	{
+		rx->rejected++;
+		return 0;
+	}
+	buf = osc_get_blob(buf, &blob);
+
+	if(!rx->active || (id != rx->id) )
+	{
+		if(!_osc_chunk_rx_start(rx, id, total, chunk))
+		{
+			rx->rejected++;
+			return 0;
+		}
+	}
+	else if( ((uint64_t)total != rx->total) || ((uint32_t)chunk != rx->chunk) )
+	{
+		rx->rejected++;
+		return 0;
+	}
+
+	// only whole chunks at chunk boundaries, the last one may be shorter
+	const uint64_t idx = offset / chunk;
+	const uint64_t len = (offset + chunk <= total)
+		? (uint64_t)chunk : (uint64_t)(total - offset);
+	if( (offset % chunk) || (idx >= rx->nchunks) || (blob.size < 0)
+			|| ((uint64_t)blob.size != len) || ((size_t)blob.size > size - 28) )
+	{
+		rx->rejected++;
+		return 0;
+	}
+
+	uint32_t *word = &rx->bitmap[idx / 32];
+	const uint32_t bit = 1U << (idx % 32);
+	if(*word & bit)
+	{
+		rx->duplicates++;
+		return 1;
+	}
+	*word |= bit;
+
+	memcpy(rx->dst + offset, blob.payload, len);
+
+	// late duplicates of a completed transfer hit the bitmap check above
+	if( (++rx->received == rx->nchunks) && rx->complete)
+		rx->complete(rx->id, rx->dst, rx->total, rx->data);
+
+	return 1;
+}
+
+// method callback, use with OSC_CHUNK_PATH and OSC_CHUNK_FMT and rx as data
+static inline int
+osc_chunk_rx_method(osc_time_t time, const char *path, const char *fmt,
+	const osc_data_t *buf, size_t size, void *data)
+{
+	osc_chunk_rx_t *rx = (osc_chunk_rx_t *)data;
+	(void)time;
+	(void)path;
+	(void)fmt;
+
+	osc_chunk_rx_args(rx, buf, size);
+
+	return 1;
+}
+
+// fill ranges with offset/size pairs of missing data, returns pair count
+static inline unsigned
+osc_chunk_rx_missing(const osc_chunk_rx_t *rx, uint64_t *ranges, unsigned max)
+{
+	unsigned n = 0;
+	uint32_t i = 0;
+
+	while( (i < rx->nchunks) && (n < max) )
+	{
+		const uint32_t word = rx->bitmap[i / 32];
+		if( (word == UINT32_MAX) && !(i % 32) ) // skip complete words
+		{
+			i += 32;
+			continue;
+		}
+
+		if(word & (1U << (i % 32)))
+		{
+			i++;
+			continue;
+		}
+
+		const uint32_t from = i;
+		while( (i < rx->nchunks) && !(rx->bitmap[i / 32] & (1U << (i % 32))) )
+			i++;
+
+		const uint64_t offset = (uint64_t)from * rx->chunk;
+		const uint64_t end = (uint64_t)i * rx->chunk;
+		ranges[2*n] = offset;
+		ranges[2*n + 1] = ((end < rx->total) ? end : rx->total) - offset;
+		n++;
+	}
+
+	return n;
+}
+
+// burst is raised to chunk, a smaller bucket would never send, returns 0
+// for a chunk size of 0 or one not fitting the int32 on the wire
+static inline int
+osc_chunk_tx_init(osc_chunk_tx_t *tx, int32_t id, const uint8_t *src,
+	uint64_t total, uint32_t chunk, uint64_t rate, uint64_t burst, uint64_t now)
+{
+	memset(tx, 0, sizeof(osc_chunk_tx_t));
+
+	if(!chunk || (chunk > INT32_MAX) )
+		return 0;
+	if(burst < chunk)
+		burst = chunk;
+
+	tx->id = id;
+	tx->src = src;
+	tx->total = total;
+	tx->chunk = chunk;
+	tx->offset = 0;
+	tx->until = total;
+	tx->rate = rate;
+	tx->burst = burst;
+	tx->tokens = burst;
+	tx->credit = 0;
+	tx->last = now;
+
+	return 1;
+}
+
+// send range again, e.g. one reported by osc_chunk_rx_missing
+static inline void
+osc_chunk_tx_restart(osc_chunk_tx_t *tx, uint64_t offset, uint64_t size)
+{
+	if(!tx->chunk) // failed init
+		return;
+
+	tx->offset = offset - offset % tx->chunk;
+	tx->until = (offset + size < tx->total) ? offset + size : tx->total;
+}
+
+static inline int
+osc_chunk_tx_done(const osc_chunk_tx_t *tx)
+{
+	return tx->offset >= tx->until;
+}
+
+// queue as many chunks as tokens allow, returns number of chunks queued,
+// flushing the batch is left to the caller
+static inline unsigned
+osc_chunk_tx_poll(osc_chunk_tx_t *tx, osc_batch_t *batch, uint64_t now)
+{
+	// refill, with elapsed time capped to avoid overflow
+	const uint64_t elapsed = now - tx->last;
+	if(elapsed >= tx->burst * 1000000000ULL / (tx->rate ? tx->rate : 1))
+	{
+		tx->tokens = tx->burst;
+		tx->credit = 0;
+	}
+	else
+	{
+		// carry the fraction of a byte over, frequent polls would lose it
+		const uint64_t credit = elapsed * tx->rate + tx->credit;
+		tx->tokens += credit / 1000000000ULL;
+		tx->credit = credit % 1000000000ULL;
+		if(tx->tokens >= tx->burst)
+		{
+			tx->tokens = tx->burst;
+			tx->credit = 0;
+		}
+	}
+	tx->last = now;
+
+	unsigned n = 0;
+	while(tx->offset < tx->until)
+	{
+		const uint64_t len = (tx->offset + tx->chunk <= tx->total)
+			? tx->chunk : tx->total - tx->offset;
+		if(len > tx->tokens)
+			break;
+
+		if(!osc_batch_vararg(batch, now, OSC_CHUNK_PATH, OSC_CHUNK_FMT, tx->id,
+				(int64_t)tx->total, (int32_t)tx->chunk, (int64_t)tx->offset,
+				(int32_t)len, tx->src + tx->offset))
+			break; // chunk larger than batch buffer
+
+		tx->tokens -= len;
+		tx->offset += len;
+		n++;
+	}
+
+	return n;
+}
+
+#endif /* _LIB_OSC_CHUNK_H_ */
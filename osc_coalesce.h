@@ -0,0 +1,222 @@
+/*
+ * Copyright (c) 2015 Hanspeter Portner (dev@open-music-kontrollers.ch)
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the Artistic License 2.0 as published by
+ * The Perl Foundation.
+ *
+ * This source is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * Artistic License 2.0 for more details.
+ *
+ * You should have received a copy of the Artistic License 2.0
+ * along the source as a COPYING file. If not, obtain it from
+ * http://www.perlfoundation.org/artistic_license_2_0.
+ */
+
+#ifndef _LIB_OSC_COALESCE_H_
+#define _LIB_OSC_COALESCE_H_
+
+#include <stdatomic.h>
+
+#include "osc.h"
+
+/*
+ * Last-value-wins queue for one producer and one consumer.
+ *
+ * Messages are keyed on their raw path and format; each key owns a slot,
+ * newer messages overwrite the argument part of the pending one in place
+ * and the consumer only ever sees the latest value per key. Slots are
+ * claimed for good on first use, the table holds at most nslots keys.
+ */
+
+#ifndef OSC_COALESCE_MAX_SIZE
+#	define OSC_COALESCE_MAX_SIZE 256
+#endif
+
+typedef struct _osc_coalesce_slot_t osc_coalesce_slot_t;
+typedef struct _osc_coalesce_t osc_coalesce_t;
+
+struct _osc_coalesce_slot_t {
+	uint32_t hash; // producer only
+	uint32_t keylen; // producer only, 0 for free slots
+
+	atomic_uint seq; // odd while producer is writing
+	atomic_uint pending;
+	atomic_size_t size;
+	osc_data_t buf [OSC_COALESCE_MAX_SIZE];
+};
+
+struct _osc_coalesce_t {
+	osc_coalesce_slot_t *slots;
+	uint32_t *ring; // indices of pending slots
+	uint32_t mask;
+
+	atomic_uint head; // producer
+	atomic_uint tail; // consumer
+
+	uint32_t coalesced; // producer only
+	uint32_t dropped; // producer only
+};
+
+// slots and ring must hold nslots elements, nslots must be a power of two
+static inline int
+osc_coalesce_init(osc_coalesce_t *coal, osc_coalesce_slot_t *slots,
+	uint32_t *ring, uint32_t nslots)
+{
+	if(!nslots || (nslots & (nslots - 1)) )
+		return 0;
+
+	coal->slots = slots;
+	coal->ring = ring;
+	coal->mask = nslots - 1;
+	atomic_init(&coal->head, 0);
+	atomic_init(&coal->tail, 0);
+	coal->coalesced = 0;
+	coal->dropped = 0;
+
+	uint32_t i;
+	for(i=0; i<nslots; i++)
+	{
+		osc_coalesce_slot_t *slot = &slots[i];
+
+		slot->hash = 0;
+		slot->keylen = 0;
+		atomic_init(&slot->seq, 0);
+		atomic_init(&slot->pending, 0);
+		atomic_init(&slot->size, 0);
+	}
+
+	return 1;
+}
+
+// find or claim slot for key, producer only
+static inline osc_coalesce_slot_t *
+_osc_coalesce_slot(osc_coalesce_t *coal, const osc_data_t *key, uint32_t keylen)
+{
+	const uint32_t hash = osc_hash(key, keylen);
+
+	uint32_t i;
+	for(i=0; i<=coal->mask; i++)
+	{
+		osc_coalesce_slot_t *slot = &coal->slots[(hash + i) & coal->mask];
+
+		if(!slot->keylen) // claim free slot
+		{
+			slot->hash = hash;
+			slot->keylen = keylen;
+			memcpy(slot->buf, key, keylen);
+			return slot;
+		}
+
+		if( (slot->hash == hash) && (slot->keylen == keylen)
+			&& !memcmp(slot->buf, key, keylen) )
+			return slot;
+	}
+
+	return NULL; // table full
+}
+
+// queue message, producer only
+static inline int
+osc_coalesce_push(osc_coalesce_t *coal, const osc_data_t *buf, size_t size)
+{
+	const osc_data_t *end = buf + size;
+	const osc_data_t *ptr = buf;
+
+	const char *path;
+	const char *fmt;
+
+	ptr = osc_get_path(ptr, &path);
+	ptr = osc_get_fmt(ptr, &fmt);
+
+	if( (*buf != '/') || (ptr > end) || (size > OSC_COALESCE_MAX_SIZE) )
+	{
+		coal->dropped++;
+		return 0;
+	}
+
+	const uint32_t keylen = ptr - buf;
+	osc_coalesce_slot_t *slot = _osc_coalesce_slot(coal, buf, keylen);
+	if(!slot)
+	{
+		coal->dropped++;
+		return 0;
+	}
+
+	// path and format are already in place, only overwrite arguments
+	const unsigned seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+	atomic_store_explicit(&slot->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	memcpy(slot->buf + keylen, ptr, size - keylen);
+	atomic_store_explicit(&slot->size, size, memory_order_relaxed);
+
+	atomic_store_explicit(&slot->seq, seq + 2, memory_order_release);
+
+	if(atomic_exchange(&slot->pending, 1))
+	{
+		coal->coalesced++; // consumer has not seen the previous value yet
+		return 1;
+	}
+
+	const unsigned head = atomic_load_explicit(&coal->head, memory_order_relaxed);
+	coal->ring[head & coal->mask] = slot - coal->slots;
+	atomic_store_explicit(&coal->head, head + 1, memory_order_release);
+
+	return 1;
+}
+
+// copy latest value of next pending key to dst, consumer only,
+// dst must hold OSC_COALESCE_MAX_SIZE bytes
+static inline int
+osc_coalesce_pop(osc_coalesce_t *coal, osc_data_t *dst, size_t *size)
+{
+	const unsigned tail = atomic_load_explicit(&coal->tail, memory_order_relaxed);
+	const unsigned head = atomic_load_explicit(&coal->head, memory_order_acquire);
+	if(tail == head)
+		return 0;
+
+	osc_coalesce_slot_t *slot = &coal->slots[coal->ring[tail & coal->mask]];
+	atomic_store_explicit(&coal->tail, tail + 1, memory_order_release);
+
+	// clear before reading, so an overlapping write queues the slot again
+	atomic_store(&slot->pending, 0);
+
+	unsigned seq1;
+	unsigned seq2;
+	size_t len;
+	do
+	{
+		seq1 = atomic_load_explicit(&slot->seq, memory_order_acquire);
+		len = atomic_load_explicit(&slot->size, memory_order_relaxed);
+		memcpy(dst, slot->buf, len);
+		atomic_thread_fence(memory_order_acquire);
+		seq2 = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+	} while( (seq1 & 1) || (seq1 != seq2) );
+
+	*size = len;
+
+	return 1;
+}
+
+// dispatch latest values of all pending keys, consumer only,
+// dst must hold OSC_COALESCE_MAX_SIZE bytes
+static inline size_t
+osc_coalesce_dispatch(osc_coalesce_t *coal, osc_data_t *dst,
+	const osc_method_t *methods, void *data)
+{
+	size_t count = 0;
+	size_t size;
+
+	while(osc_coalesce_pop(coal, dst, &size))
+	{
+		_osc_method_dispatch_message(OSC_IMMEDIATE, dst, size, methods, data);
+		count++;
+	}
+
+	return count;
+}
+
+#endif /* _LIB_OSC_COALESCE_H_ */
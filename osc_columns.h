@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2015 Hanspeter Portner (dev@open-music-kontrollers.ch)
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the Artistic License 2.0 as published by
+ * The Perl Foundation.
+ *
+ * This source is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * Artistic License 2.0 for more details.
+ *
+ * You should have received a copy of the Artistic License 2.0
+ * along the source as a COPYING file. If not, obtain it from
+ * http://www.perlfoundation.org/artistic_license_2_0.
+ */
+
+#ifndef _LIB_OSC_COLUMNS_H_
+#define _LIB_OSC_COLUMNS_H_
+
+#include "osc.h"
+
+/*
+ * Columnar batch extraction.
+ *
+ * Messages matching one all-fixed-size signature are validated with a
+ * single size and format compare and their arguments are gathered into one
+ * caller-provided column per argument position, still in network byte
+ * order. osc_columns_finish then converts every column in one bulk swap.
+ * 32-bit types land in 32-bit columns (OSC_CHAR as int32_t), 64-bit types
+ * in 64-bit columns, OSC_MIDI is kept as raw 4 bytes.
+ */
+
+#ifndef OSC_COLUMNS_MAX
+#	define OSC_COLUMNS_MAX 16
+#endif
+
+typedef struct _osc_columns_t osc_columns_t;
+
+struct _osc_columns_t {
+	const char *path; // NULL matches all paths
+	char fmt [OSC_PADDED_SIZE(OSC_COLUMNS_MAX + 2)]; // zero padded
+	uint32_t ncols;
+	uint8_t width [OSC_COLUMNS_MAX];
+	size_t fmtlen; // padded format length including ','
+	size_t argsize; // size of all arguments of one row
+
+	void **columns; // ncols arrays of capacity elements, NULL to skip
+	osc_time_t *times; // optional timetag column
+	size_t capacity;
+
+	size_t rows;
+	size_t swapped; // rows already in host byte order
+	uint32_t rejected; // matching format, but wrong size
+};
+
+// fmt without leading ',', columns must hold one pointer per argument
+static inline int
+osc_columns_init(osc_columns_t *cols, const char *path, const char *fmt,
+	void **columns, osc_time_t *times, size_t capacity)
+{
+	const size_t ncols = strlen(fmt);
+	if(ncols > OSC_COLUMNS_MAX)
+		return 0;
+
+	cols->argsize = 0;
+
+	size_t i;
+	for(i=0; i<ncols; i++)
+	{
+		const int size = osc_type_size((osc_type_t)fmt[i]);
+		if(size <= 0) // variable-size or without payload
+			return 0;
+		cols->width[i] = size;
+		cols->argsize += size;
+	}
+
+	cols->path = path;
+	memset(cols->fmt, '\0', sizeof(cols->fmt));
+	strcpy(cols->fmt, fmt);
+	cols->ncols = ncols;
+	cols->fmtlen = osc_fmtlen(fmt) + 1;
+	cols->columns = columns;
+	cols->times = times;
+	cols->capacity = capacity;
+	cols->rows = 0;
+	cols->swapped = 0;
+	cols->rejected = 0;
+
+	return 1;
+}
+
+static inline void
+osc_columns_reset(osc_columns_t *cols)
+{
+	cols->rows = 0;
+	cols->swapped = 0;
+}
+
+static inline void
+_osc_columns_message(osc_columns_t *cols, osc_time_t time,
+	const osc_data_t *buf, size_t size)
+{
+	const osc_data_t *ptr = buf;
+	const osc_data_t *end = buf + size;
+	const char *path;
+
+	ptr = osc_get_path(ptr, &path);
+	if( (ptr + cols->fmtlen > end) || (cols->path && strcmp(cols->path, path)) )
+		return;
+
+	// compare including padding, ptr[cols->fmtlen-1] is the last zero
+	if( (ptr[0] != ',') || memcmp(ptr + 1, cols->fmt, cols->fmtlen - 1) )
+		return;
+	ptr += cols->fmtlen;
+
+	if(ptr + cols->argsize != end)
+	{
+		cols->rejected++;
+		return;
+	}
+
+	const size_t row = cols->rows++;
+
+	uint32_t i;
+	for(i=0; i<cols->ncols; i++)
+	{
+		const size_t width = cols->width[i];
+		if(cols->columns[i])
+			memcpy((uint8_t *)cols->columns[i] + row*width, ptr, width);
+		ptr += width;
+	}
+
+	if(cols->times)
+		cols->times[row] = time;
+}
+
+static inline void
+_osc_columns_bundle(osc_columns_t *cols, const osc_data_t *buf, size_t size)
+{
+	const osc_data_t *end = buf + size;
+
+	osc_time_t time;
+	const osc_data_t *ptr = osc_get_bundle(buf, &time); // skip bundle header
+	if(!ptr)
+		return;
+
+	while( (ptr + 4 <= end) && (cols->rows < cols->capacity) )
+	{
+		int32_t len = be32toh(*((const int32_t *)ptr));
+		ptr += sizeof(int32_t);
+		if( (len <= 0) || (ptr + len > end) )
+			return;
+
+		switch(*ptr)
+		{
+			case '#':
+				_osc_columns_bundle(cols, ptr, len);
+				break;
+			case '/':
+				_osc_columns_message(cols, time, ptr, len);
+				break;
+		}
+		ptr += len;
+	}
+}
+
+// gather matching messages of packet, returns number of rows appended
+static inline size_t
+osc_columns_extract(osc_columns_t *cols, const osc_data_t *buf, size_t size)
+{
+	const size_t rows = cols->rows;
+
+	if(rows == cols->capacity)
+		return 0;
+
+	switch(*buf)
+	{
+		case '#':
+			_osc_columns_bundle(cols, buf, size);
+			break;
+		case '/':
+			_osc_columns_message(cols, OSC_IMMEDIATE, buf, size);
+			break;
+	}
+
+	return cols->rows - rows;
+}
+
+// convert rows gathered since last call to host byte order
+static inline size_t
+osc_columns_finish(osc_columns_t *cols)
+{
+	const size_t from = cols->swapped;
+	const size_t n = cols->rows - from;
+
+	uint32_t i;
+	for(i=0; i<cols->ncols; i++)
+	{
+		uint8_t *col = (uint8_t *)cols->columns[i];
+		if(!col || (cols->fmt[i] == OSC_MIDI) )
+			continue;
+
+		if(cols->width[i] == 4)
+			osc_swap32_n(col + from*4, col + from*4, n);
+		else
+			osc_swap64_n(col + from*8, col + from*8, n);
+	}
+
+	cols->swapped = cols->rows;
+
+	return cols->rows;
+}
+
+#endif /* _LIB_OSC_COLUMNS_H_ */
@@ -0,0 +1,460 @@
+/*
+ * Copyright (c) 2015 Hanspeter Portner (dev@open-music-kontrollers.ch)
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the Artistic License 2.0 as published by
+ * The Perl Foundation.
+ *
+ * This source is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * Artistic License 2.0 for more details.
+ *
+ * You should have received a copy of the Artistic License 2.0
+ * along the source as a COPYING file. If not, obtain it from
+ * http://www.perlfoundation.org/artistic_license_2_0.
+ */
+
+#ifndef _LIB_OSC_CORO_HPP_
+#define _LIB_OSC_CORO_HPP_
+
+#include "osc.hpp"
+
+#include <algorithm>
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace osc {
+
+/*
+ * Coroutine receive API, C++20.
+ *
+ * A task is a fire-and-forget coroutine which starts eagerly and frees
+ * itself when done, its frame comes from a thread-local pool. Inside a
+ * task, co_await rx.next(pattern) suspends until receiver::dispatch sees a
+ * matching message and yields its message_view, co_await rx.at(time)
+ * suspends until receiver::tick is called with a time not before it. Both
+ * resume on the thread calling dispatch or tick. The message_view refers to
+ * the dispatched packet and is valid until the task suspends again.
+ *
+ * Patterns are either exact paths, or prefixes whose last component is a
+ * single '*', which match everything below. Each message resumes a waiter
+ * at most once, a task resumed by it waits for the next message whatever
+ * pattern it awaits then. Waiters are kept in intrusive lists indexed by
+ * pattern, entries stay in place when emptied, so once every pattern and
+ * the timer heap have been seen neither waiting nor resuming allocates.
+ */
+
+namespace detail {
+
+class frame_pool
+{
+public:
+	static constexpr size_t granularity = 64;
+	static constexpr size_t classes = 16; // up to 1K, larger frames bypass
+
+	static void *
+	allocate(size_t size)
+	{
+		const size_t cls = (size + granularity - 1) / granularity - 1;
+		if(cls >= classes)
+			return ::operator new(size);
+
+		cache &c = local();
+		if(node *n = c.free[cls])
+		{
+			c.free[cls] = n->next;
+			return n;
+		}
+
+		return ::operator new((cls + 1) * granularity);
+	}
+
+	static void
+	deallocate(void *ptr, size_t size) noexcept
+	{
+		const size_t cls = (size + granularity - 1) / granularity - 1;
+		if(cls >= classes)
+		{
+			::operator delete(ptr);
+			return;
+		}
+
+		cache &c = local();
+		node *n = static_cast<node *>(ptr);
+		n->next = c.free[cls];
+		c.free[cls] = n;
+	}
+
+private:
+	struct node
+	{
+		node *next;
+	};
+
+	struct cache
+	{
+		std::array<node *, classes> free = {};
+
+		~cache()
+		{
+			for(node *n : free)
+				while(n)
+				{
+					node *next = n->next;
+					::operator delete(n);
+					n = next;
+				}
+		}
+	};
+
+	static cache &
+	local() noexcept
+	{
+		thread_local cache c;
+		return c;
+	}
+};
+
+// transparent hash, lookups by string_view do not allocate
+struct path_hash
+{
+	using is_transparent = void;
+
+	size_t
+	operator()(std::string_view path) const noexcept
+	{
+		return osc_hash(path.data(), path.size());
+	}
+};
+
+} // namespace detail
+
+class task
+{
+public:
+	struct promise_type
+	{
+		static void *
+		operator new(size_t size)
+		{
+			return detail::frame_pool::allocate(size);
+		}
+
+		static void
+		operator delete(void *ptr, size_t size) noexcept
+		{
+			detail::frame_pool::deallocate(ptr, size);
+		}
+
+		task
+		get_return_object() noexcept
+		{
+			return {};
+		}
+
+		std::suspend_never
+		initial_suspend() noexcept
+		{
+			return {};
+		}
+
+		std::suspend_never
+		final_suspend() noexcept
+		{
+			return {};
+		}
+
+		void
+		return_void() noexcept
+		{}
+
+		void
+		unhandled_exception() noexcept
+		{
+			std::terminate();
+		}
+	};
+};
+
+class receiver
+{
+	struct waiter;
+
+	// FIFO of waiters on one pattern
+	struct queue
+	{
+		waiter *head = nullptr;
+		waiter *tail = nullptr;
+	};
+
+	using index = std::unordered_map<std::string, queue, detail::path_hash,
+		std::equal_to<>>;
+
+	struct waiter
+	{
+		std::coroutine_handle<> handle;
+		waiter *next = nullptr;
+		message_view msg;
+	};
+
+	struct timer
+	{
+		osc_time_t time;
+		uint64_t seq; // keeps timers with equal time in order
+		std::coroutine_handle<> handle;
+
+		bool
+		operator>(const timer &other) const noexcept
+		{
+			return (time != other.time) ? time > other.time : seq > other.seq;
+		}
+	};
+
+public:
+	class message_awaiter
+	{
+	public:
+		message_awaiter(receiver &rx, std::string_view pattern) noexcept
+			: rx_(rx), pattern_(pattern)
+		{}
+
+		bool
+		await_ready() const noexcept
+		{
+			return false;
+		}
+
+		void
+		await_suspend(std::coroutine_handle<> handle)
+		{
+			waiter_.handle = handle;
+			rx_.enqueue(pattern_, &waiter_);
+		}
+
+		message_view
+		await_resume() const noexcept
+		{
+			return waiter_.msg;
+		}
+
+	private:
+		receiver &rx_;
+		std::string_view pattern_;
+		waiter waiter_;
+	};
+
+	class time_awaiter
+	{
+	public:
+		time_awaiter(receiver &rx, osc_time_t time) noexcept
+			: rx_(rx), time_(time)
+		{}
+
+		bool
+		await_ready() const noexcept
+		{
+			return (time_ == OSC_IMMEDIATE) || (time_ <= rx_.now_);
+		}
+
+		void
+		await_suspend(std::coroutine_handle<> handle)
+		{
+			rx_.schedule(time_, handle);
+		}
+
+		void
+		await_resume() const noexcept
+		{}
+
+	private:
+		receiver &rx_;
+		osc_time_t time_;
+	};
+
+	receiver() = default;
+
+	receiver(const receiver &) = delete;
+	receiver &operator=(const receiver &) = delete;
+
+	// destroys suspended tasks
+	~receiver()
+	{
+		for(index *idx : {&exact_, &prefix_})
+			for(auto &entry : *idx)
+				for(waiter *w = std::exchange(entry.second.head, nullptr); w; )
+				{
+					waiter *next = w->next;
+					w->handle.destroy();
+					w = next;
+				}
+
+		for(const timer &t : timers_)
+			t.handle.destroy();
+	}
+
+	// pattern must stay valid until the awaiter is resumed
+	message_awaiter
+	next(std::string_view pattern) noexcept
+	{
+		return message_awaiter(*this, pattern);
+	}
+
+	time_awaiter
+	at(osc_time_t time) noexcept
+	{
+		return time_awaiter(*this, time);
+	}
+
+	// reserve room for timers, so scheduling them does not allocate
+	void
+	reserve_timers(size_t n)
+	{
+		timers_.reserve(n);
+	}
+
+	// resume waiters of all messages in packet, bundles are not delayed
+	void
+	dispatch(std::span<const std::byte> buf)
+	{
+		if(buf.empty())
+			return;
+
+		switch(char(buf[0]))
+		{
+			case '#':
+				for(const element item : bundle_view(buf))
+					dispatch(item.data());
+				break;
+			case '/':
+				dispatch_message(message_view(buf));
+				break;
+		}
+	}
+
+	void
+	dispatch(const osc_data_t *buf, size_t size)
+	{
+		dispatch(std::span<const std::byte>(
+			reinterpret_cast<const std::byte *>(buf), size));
+	}
+
+	// resume timers due at now
+	void
+	tick(osc_time_t now)
+	{
+		now_ = now;
+
+		while(!timers_.empty() && (timers_.front().time <= now))
+		{
+			std::pop_heap(timers_.begin(), timers_.end(), std::greater<>());
+			const std::coroutine_handle<> handle = timers_.back().handle;
+			timers_.pop_back();
+			handle.resume();
+		}
+	}
+
+	// number of tasks waiting for messages or time
+	size_t
+	pending() const noexcept
+	{
+		return nwaiting_ + timers_.size();
+	}
+
+private:
+	void
+	enqueue(std::string_view pattern, waiter *w)
+	{
+		index *idx = &exact_;
+		if(pattern.ends_with("/*"))
+		{
+			idx = &prefix_;
+			pattern.remove_suffix(1); // keep trailing '/'
+		}
+
+		auto itr = idx->find(pattern);
+		if(itr == idx->end())
+			itr = idx->emplace(std::string(pattern), queue()).first;
+
+		queue &q = itr->second;
+		w->next = nullptr;
+		if(q.tail)
+			q.tail->next = w;
+		else
+			q.head = w;
+		q.tail = w;
+		nwaiting_++;
+	}
+
+	void
+	schedule(osc_time_t time, std::coroutine_handle<> handle)
+	{
+		timers_.push_back({time, seq_++, handle});
+		std::push_heap(timers_.begin(), timers_.end(), std::greater<>());
+	}
+
+	// move all waiters of entry to the end of chain
+	void
+	detach(index &idx, std::string_view key, queue &chain)
+	{
+		const auto itr = idx.find(key);
+		if( (itr == idx.end()) || !itr->second.head)
+			return;
+
+		queue &q = itr->second;
+		if(chain.tail)
+			chain.tail->next = q.head;
+		else
+			chain.head = q.head;
+		chain.tail = q.tail;
+		q.head = nullptr;
+		q.tail = nullptr;
+	}
+
+	void
+	dispatch_message(const message_view &msg)
+	{
+		if(!nwaiting_)
+			return;
+
+		const std::string_view path = msg.path();
+		if(path.empty())
+			return;
+
+		// detach every match before resuming any, waiters registered while
+		// resuming, even on a deeper prefix, wait for the next message
+		queue chain;
+		if(!exact_.empty())
+			detach(exact_, path, chain);
+
+		if(!prefix_.empty()) // one lookup per '/' boundary
+			for(size_t i = 0; i < path.size(); i++)
+				if(path[i] == '/')
+					detach(prefix_, path.substr(0, i + 1), chain);
+
+		for(waiter *w = chain.head; w; )
+		{
+			waiter *next = w->next; // frame may be gone after resume
+			nwaiting_--;
+			w->msg = msg;
+			w->handle.resume();
+			w = next;
+		}
+	}
+
+	index exact_;
+	index prefix_; // keys keep their trailing '/'
+	std::vector<timer> timers_;
+	uint64_t seq_ = 0;
+	osc_time_t now_ = 0;
+	size_t nwaiting_ = 0;
+};
+
+} // namespace osc
+
+#endif /* _LIB_OSC_CORO_HPP_ */
@@ -0,0 +1,276 @@
+/*
+ * Copyright (c) 2015 Hanspeter Portner (dev@open-music-kontrollers.ch)
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the Artistic License 2.0 as published by
+ * The Perl Foundation.
+ *
+ * This source is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * Artistic License 2.0 for more details.
+ *
+ * You should have received a copy of the Artistic License 2.0
+ * along the source as a COPYING file. If not, obtain it from
+ * http://www.perlfoundation.org/artistic_license_2_0.
+ */
+
+#ifndef _LIB_OSC_FMT_H_
+#define _LIB_OSC_FMT_H_
+
+#include "osc.h"
+
+/*
+ * Compiled format strings.
+ *
+ * A descriptor records per argument its size and, up to the first
+ * variable-size argument, its offset from the start of the arguments, plus
+ * the total size of all fixed-size arguments. Validation, decoding and
+ * encoding then run from the descriptor instead of interpreting the format
+ * character by character. Descriptors are cached in a small hash keyed by
+ * the format bytes. Arguments are indexed by their position in the format,
+ * array markers included. Formats with more than OSC_FMT_MAX_ARGS
+ * arguments cannot be compiled, osc_check_message_compiled falls back to
+ * osc_check_message for them.
+ */
+
+#ifndef OSC_FMT_MAX_ARGS
+#	define OSC_FMT_MAX_ARGS 32
+#endif
+
+#ifndef OSC_FMT_CACHE_SIZE
+#	define OSC_FMT_CACHE_SIZE 64 // must be a power of two
+#endif
+
+#define OSC_FMT_CACHE_PROBE 4
+
+typedef struct _osc_fmt_desc_t osc_fmt_desc_t;
+typedef struct _osc_fmt_cache_t osc_fmt_cache_t;
+
+struct _osc_fmt_desc_t {
+	uint32_t hash;
+	uint16_t len; // format length without ','
+	uint16_t nfixed; // leading arguments with fixed offsets
+	uint32_t prefix_size; // size of leading fixed-size arguments
+	uint32_t fixed_size; // size of all fixed-size arguments
+	int used;
+
+	char fmt [OSC_FMT_MAX_ARGS + 1];
+	int8_t size [OSC_FMT_MAX_ARGS]; // -1 for variable-size arguments
+	uint16_t offset [OSC_FMT_MAX_ARGS]; // valid for the first nfixed only
+};
+
+struct _osc_fmt_cache_t {
+	uint32_t hits;
+	uint32_t misses;
+
+	osc_fmt_desc_t desc [OSC_FMT_CACHE_SIZE];
+};
+
+// compile format string without leading ','
+static inline int
+osc_fmt_compile(osc_fmt_desc_t *desc, const char *fmt)
+{
+	const size_t len = strlen(fmt);
+	if( (len > OSC_FMT_MAX_ARGS) || !osc_check_fmt(fmt, 0) )
+		return 0;
+
+	desc->hash = osc_hash(fmt, len);
+	desc->len = len;
+	desc->nfixed = 0;
+	desc->prefix_size = 0;
+	desc->fixed_size = 0;
+	memcpy(desc->fmt, fmt, len + 1);
+
+	int depth = 0;
+	int variable = 0;
+
+	size_t i;
+	for(i=0; i<len; i++)
+	{
+		const int size = osc_type_size((osc_type_t)fmt[i]);
+
+		if(fmt[i] == OSC_AOPEN)
+			depth++;
+		else if( (fmt[i] == OSC_ACLOSE) && (--depth < 0) )
+			return 0;
+
+		desc->size[i] = size;
+		if(size < 0)
+		{
+			variable = 1;
+			continue;
+		}
+
+		if(!variable)
+		{
+			desc->offset[i] = desc->prefix_size;
+			desc->prefix_size += size;
+			desc->nfixed++;
+		}
+		desc->fixed_size += size;
+	}
+
+	if(depth)
+		return 0;
+
+	desc->used = 1;
+
+	return 1;
+}
+
+static inline void
+osc_fmt_cache_init(osc_fmt_cache_t *cache)
+{
+	unsigned i;
+	for(i=0; i<OSC_FMT_CACHE_SIZE; i++)
+		cache->desc[i].used = 0;
+
+	cache->hits = 0;
+	cache->misses = 0;
+}
+
+// get descriptor for format without leading ',', NULL for invalid or too
+// long formats, valid until the next call on the same cache may evict it
+static inline const osc_fmt_desc_t *
+osc_fmt_cache_get(osc_fmt_cache_t *cache, const char *fmt)
+{
+	const size_t len = strlen(fmt);
+	const uint32_t hash = osc_hash(fmt, len);
+	osc_fmt_desc_t *victim = &cache->desc[hash & (OSC_FMT_CACHE_SIZE - 1)];
+
+	unsigned i;
+	for(i=0; i<OSC_FMT_CACHE_PROBE; i++)
+	{
+		osc_fmt_desc_t *desc = &cache->desc[(hash + i) & (OSC_FMT_CACHE_SIZE - 1)];
+
+		if(!desc->used)
+		{
+			victim = desc;
+			break;
+		}
+
+		if( (desc->hash == hash) && (desc->len == len)
+			&& !memcmp(desc->fmt, fmt, len) )
+		{
+			cache->hits++;
+			return desc;
+		}
+	}
+
+	// miss, reuse free slot or evict the home slot, keep it on failure
+	cache->misses++;
+	osc_fmt_desc_t desc;
+	if(!osc_fmt_compile(&desc, fmt))
+		return NULL;
+
+	*victim = desc;
+	return victim;
+}
+
+// check arguments from args to end against descriptor
+static inline int
+osc_fmt_check(const osc_fmt_desc_t *desc, const osc_data_t *args,
+	const osc_data_t *end)
+{
+	if(desc->nfixed == desc->len) // all fixed-size, one size compare
+		return args + desc->fixed_size == end;
+
+	const osc_data_t *ptr = args + desc->prefix_size;
+
+	unsigned i;
+	for(i=desc->nfixed; (i<desc->len) && (ptr <= end); i++)
+	{
+		if(desc->size[i] >= 0)
+			ptr += desc->size[i];
+		else if(desc->fmt[i] == OSC_BLOB)
+			ptr = (ptr + 4 <= end) ? ptr + osc_bloblen(ptr) : end + 1;
+		else // OSC_STRING, OSC_SYMBOL
+			ptr += OSC_PADDED_SIZE(strnlen((const char *)ptr, end - ptr) + 1);
+	}
+
+	return ptr == end;
+}
+
+// decode all arguments of checked message into argv, one per format char
+static inline const osc_data_t *
+osc_fmt_get(const osc_fmt_desc_t *desc, const osc_data_t *args,
+	osc_argument_t *argv)
+{
+	unsigned i;
+	for(i=0; i<desc->nfixed; i++) // no dependency between fixed offsets
+		osc_get((osc_type_t)desc->fmt[i], args + desc->offset[i], &argv[i]);
+
+	const osc_data_t *ptr = args + desc->prefix_size;
+	for( ; i<desc->len; i++)
+		ptr = osc_get((osc_type_t)desc->fmt[i], ptr, &argv[i]);
+
+	return ptr;
+}
+
+// encode all arguments from argv, one per format char
+static inline osc_data_t *
+osc_fmt_set(const osc_fmt_desc_t *desc, osc_data_t *buf, const osc_data_t *end,
+	const osc_argument_t *argv)
+{
+	if(!buf || (buf + desc->fixed_size > end) )
+		return NULL;
+
+	unsigned i;
+	if(desc->nfixed == desc->len) // all fixed-size, bounds already checked
+	{
+		for(i=0; i<desc->len; i++)
+			osc_set(buf + desc->offset[i], end, (osc_type_t)desc->fmt[i],
+				(osc_argument_t *)&argv[i]);
+		return buf + desc->fixed_size;
+	}
+
+	osc_data_t *ptr = buf;
+	for(i=0; i<desc->len; i++)
+		ptr = osc_set(ptr, end, (osc_type_t)desc->fmt[i], (osc_argument_t *)&argv[i]);
+
+	return ptr;
+}
+
+// same result as osc_check_message, with cached format descriptors
+static inline int
+osc_check_message_compiled(osc_fmt_cache_t *cache, const osc_data_t *buf,
+	size_t size)
+{
+	const osc_data_t *ptr = buf;
+	const osc_data_t *end = buf + size;
+
+	const char *path = NULL;
+	const char *fmt = NULL;
+
+	ptr = osc_get_path(ptr, &path);
+	if( (ptr > end) || !osc_check_path(path) )
+		return 0;
+
+	ptr = osc_get_fmt(ptr, &fmt);
+	if( (ptr > end) || (fmt[0] != ',') )
+		return 0;
+
+	const osc_fmt_desc_t *desc = osc_fmt_cache_get(cache, fmt + 1);
+	if(!desc) // invalid or too long to compile
+		return (strlen(fmt + 1) > OSC_FMT_MAX_ARGS)
+			? osc_check_message(buf, size) : 0;
+
+	return osc_fmt_check(desc, ptr, end);
+}
+
+// write path, format and arguments from argv in one go
+static inline osc_data_t *
+osc_set_compiled(osc_data_t *buf, const osc_data_t *end, const char *path,
+	const osc_fmt_desc_t *desc, const osc_argument_t *argv)
+{
+	osc_data_t *ptr = buf;
+
+	ptr = osc_set_path(ptr, end, path);
+	ptr = osc_set_fmt(ptr, end, desc->fmt);
+	ptr = osc_fmt_set(desc, ptr, end, argv);
+
+	return ptr;
+}
+
+#endif /* _LIB_OSC_FMT_H_ */
@@ -0,0 +1,281 @@
+/*
+ * Copyright (c) 2015 Hanspeter Portner (dev@open-music-kontrollers.ch)
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the Artistic License 2.0 as published by
+ * The Perl Foundation.
+ *
+ * This source is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * Artistic License 2.0 for more details.
+ *
+ * You should have received a copy of the Artistic License 2.0
+ * along the source as a COPYING file. If not, obtain it from
+ * http://www.perlfoundation.org/artistic_license_2_0.
+ */
+
+#ifndef _LIB_OSC_INTERN_H_
+#define _LIB_OSC_INTERN_H_
+
+#include "osc.h"
+
+/*
+ * Path interning and compact messages.
+ *
+ * The registry maps path strings to dense IDs in order of registration,
+ * strings are referenced, not copied. A compact message replaces the path
+ * with a 4 byte header, OSC_COMPACT followed by the 24-bit big-endian ID,
+ * format and arguments stay as they are. Compact messages are meant for
+ * internal hops only, convert them back with osc_intern_expand at the edge.
+ */
+
+#define OSC_COMPACT '!'
+#define OSC_COMPACT_MAX_ID 0xffffff
+
+typedef struct _osc_intern_entry_t osc_intern_entry_t;
+typedef struct _osc_intern_t osc_intern_t;
+
+struct _osc_intern_entry_t {
+	uint32_t hash;
+	int32_t id; // -1 for free entries
+};
+
+struct _osc_intern_t {
+	osc_intern_entry_t *table;
+	uint32_t mask;
+
+	const char **paths; // ID to path
+	uint32_t max;
+	uint32_t count;
+};
+
+// table must hold nslots entries, nslots a power of two larger than max
+static inline int
+osc_intern_init(osc_intern_t *reg, osc_intern_entry_t *table, uint32_t nslots,
+	const char **paths, uint32_t max)
+{
+	if(!nslots || (nslots & (nslots - 1)) || (max >= nslots)
+			|| (max > OSC_COMPACT_MAX_ID + 1) )
+		return 0;
+
+	reg->table = table;
+	reg->mask = nslots - 1;
+	reg->paths = paths;
+	reg->max = max;
+	reg->count = 0;
+
+	uint32_t i;
+	for(i=0; i<nslots; i++)
+	{
+		table[i].hash = 0;
+		table[i].id = -1;
+	}
+
+	return 1;
+}
+
+// find table entry for path, either matching or free
+static inline osc_intern_entry_t *
+_osc_intern_entry(const osc_intern_t *reg, const char *path, size_t len)
+{
+	const uint32_t hash = osc_hash(path, len);
+
+	uint32_t i;
+	for(i=hash & reg->mask; ; i=(i + 1) & reg->mask) // never full, see init
+	{
+		osc_intern_entry_t *entry = &reg->table[i];
+
+		if( (entry->id == -1)
+			|| ((entry->hash == hash) && !strcmp(reg->paths[entry->id], path)) )
+			return entry;
+	}
+}
+
+static inline int32_t
+osc_intern_lookup(const osc_intern_t *reg, const char *path)
+{
+	return _osc_intern_entry(reg, path, strlen(path))->id;
+}
+
+// register path, returns its ID or -1 if the registry is full
+static inline int32_t
+osc_intern_add(osc_intern_t *reg, const char *path)
+{
+	if(path[0] != '/')
+		return -1;
+
+	osc_intern_entry_t *entry = _osc_intern_entry(reg, path, strlen(path));
+	if(entry->id != -1)
+		return entry->id;
+
+	if(reg->count >= reg->max)
+		return -1;
+
+	entry->hash = osc_hash(path, strlen(path));
+	entry->id = reg->count++;
+	reg->paths[entry->id] = path;
+
+	return entry->id;
+}
+
+static inline const char *
+osc_intern_path(const osc_intern_t *reg, int32_t id)
+{
+	if( (id < 0) || ((uint32_t)id >= reg->count) )
+		return NULL;
+	return reg->paths[id];
+}
+
+static inline const osc_data_t *
+osc_get_compact_path(const osc_data_t *buf, int32_t *id)
+{
+	if(!buf || (buf[0] != OSC_COMPACT) )
+		return NULL;
+	*id = (buf[1] << 16) | (buf[2] << 8) | buf[3];
+	return buf + 4;
+}
+
+static inline osc_data_t *
+osc_set_compact_path(osc_data_t *buf, const osc_data_t *end, int32_t id)
+{
+	if(!buf || (buf + 4 > end) || (id < 0) || (id > OSC_COMPACT_MAX_ID) )
+		return NULL;
+	buf[0] = OSC_COMPACT;
+	buf[1] = (id >> 16) & 0xff;
+	buf[2] = (id >> 8) & 0xff;
+	buf[3] = id & 0xff;
+	return buf + 4;
+}
+
+// convert message to compact form, dst may be equal to buf
+static inline osc_data_t *
+osc_intern_compact(const osc_intern_t *reg, const osc_data_t *buf, size_t size,
+	osc_data_t *dst, const osc_data_t *end)
+{
+	const char *path;
+	const osc_data_t *ptr = osc_get_path(buf, &path);
+	const size_t len = size - (ptr - buf);
+
+	const int32_t id = osc_intern_lookup(reg, path);
+	if(id == -1)
+		return NULL;
+
+	osc_data_t *dptr = osc_set_compact_path(dst, end, id);
+	if(!dptr || (dptr + len > end) )
+		return NULL;
+	memmove(dptr, ptr, len);
+
+	return dptr + len;
+}
+
+// convert compact message to standard form, dst must not overlap buf
+static inline osc_data_t *
+osc_intern_expand(const osc_intern_t *reg, const osc_data_t *buf, size_t size,
+	osc_data_t *dst, const osc_data_t *end)
+{
+	int32_t id;
+	const osc_data_t *ptr = osc_get_compact_path(buf, &id);
+	const char *path = osc_intern_path(reg, id);
+	if(!ptr || !path)
+		return NULL;
+
+	const size_t len = size - 4;
+	osc_data_t *dptr = osc_set_path(dst, end, path);
+	if(!dptr || (dptr + len > end) )
+		return NULL;
+	memcpy(dptr, ptr, len);
+
+	return dptr + len;
+}
+
+// dispatch standard or compact message, methods are indexed by ID
+static inline void
+_osc_intern_dispatch_message(const osc_intern_t *reg, osc_time_t time,
+	const osc_data_t *buf, size_t size, const osc_method_t *methods, void *data)
+{
+	const osc_data_t *ptr = buf;
+	const char *path;
+	const char *fmt;
+	int32_t id;
+
+	if(*buf == OSC_COMPACT)
+	{
+		ptr = osc_get_compact_path(ptr, &id);
+		path = osc_intern_path(reg, id);
+		if(!path)
+			return;
+	}
+	else
+	{
+		ptr = osc_get_path(ptr, &path);
+		id = osc_intern_lookup(reg, path);
+		if(id == -1)
+			return;
+	}
+	ptr = osc_get_fmt(ptr, &fmt);
+
+	const osc_method_t *meth = &methods[id];
+	if(meth->cb && (!meth->fmt || !strcmp(meth->fmt, fmt+1)) )
+		meth->cb(time, path, fmt+1, ptr, size-(ptr-buf), data);
+}
+
+static inline void
+_osc_intern_dispatch_bundle(const osc_intern_t *reg, const osc_data_t *buf,
+	size_t size, const osc_method_t *methods, osc_bundle_in_cb_t bundle_in,
+	osc_bundle_out_cb_t bundle_out, void *data)
+{
+	const osc_data_t *end = buf + size;
+
+	osc_time_t time;
+	const osc_data_t *ptr = osc_get_bundle(buf, &time); // skip bundle header
+	if(!ptr)
+		return;
+
+	if(bundle_in)
+		bundle_in(time, data);
+
+	while(ptr < end)
+	{
+		int32_t len = be32toh(*((const int32_t *)ptr));
+		ptr += sizeof(int32_t);
+		switch(*ptr)
+		{
+			case '#':
+				_osc_intern_dispatch_bundle(reg, ptr, len, methods, bundle_in,
+					bundle_out, data);
+				break;
+			case '/':
+			case OSC_COMPACT:
+				_osc_intern_dispatch_message(reg, time, ptr, len, methods, data);
+				break;
+		}
+		ptr += len;
+	}
+
+	if(bundle_out)
+		bundle_out(time, data);
+}
+
+// like osc_dispatch_method, but with a direct index into methods by ID,
+// methods must hold an entry for every registered ID
+static inline void
+osc_intern_dispatch_method(const osc_intern_t *reg, const osc_data_t *buf,
+	size_t size, const osc_method_t *methods, osc_bundle_in_cb_t bundle_in,
+	osc_bundle_out_cb_t bundle_out, void *data)
+{
+	switch(*buf)
+	{
+		case '#':
+			_osc_intern_dispatch_bundle(reg, buf, size, methods, bundle_in,
+				bundle_out, data);
+			break;
+		case '/':
+		case OSC_COMPACT:
+			_osc_intern_dispatch_message(reg, OSC_IMMEDIATE, buf, size, methods,
+				data);
+			break;
+	}
+}
+
+#endif /* _LIB_OSC_INTERN_H_ */
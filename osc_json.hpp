@@ -0,0 +1,543 @@
+/*
+ * Copyright (c) 2015 Hanspeter Portner (dev@open-music-kontrollers.ch)
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the Artistic License 2.0 as published by
+ * The Perl Foundation.
+ *
+ * This source is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * Artistic License 2.0 for more details.
+ *
+ * You should have received a copy of the Artistic License 2.0
+ * along the source as a COPYING file. If not, obtain it from
+ * http://www.perlfoundation.org/artistic_license_2_0.
+ */
+
+#ifndef _LIB_OSC_JSON_HPP_
+#define _LIB_OSC_JSON_HPP_
+
+#include "osc.hpp"
+
+extern "C" {
+#include "osc_time.h"
+}
+
+#include <charconv>
+#include <cmath>
+
+#if defined(__SSE2__)
+#	include <emmintrin.h>
+#endif
+#if defined(__SSSE3__)
+#	include <tmmintrin.h>
+#endif
+
+namespace osc {
+
+/*
+ * NDJSON export, C++20.
+ *
+ * Every message becomes one line, messages of bundles are flattened in
+ * packet order and carry the timetag of their innermost bundle:
+ *
+ *   {"time":1700000000.250000000,"path":"/foo","types":"ifs","args":[1,2.5,"x"]}
+ *
+ * time is in Unix seconds with nanosecond digits, null for immediate
+ * bundles and missing for bare messages. Arguments map to JSON by type:
+ * integers and finite floats to numbers (shortest round-trip via
+ * std::to_chars, other floats to null), strings, symbols and chars to
+ * strings, blobs to base64 strings, T and F to booleans, N and I to null,
+ * timetags like time, MIDI to arrays of four bytes, RGBA to "#rrggbbaa"
+ * and OSC arrays to nested arrays.
+ *
+ * Output goes straight into a buffer of json_bound bytes, there is no
+ * intermediate document. Strings are scanned for characters to escape 16
+ * bytes at a time with SSE2, blobs are base64-encoded 12 bytes at a time
+ * with SSSE3, both fall back to scalar code. Bytes above 0x7f are copied
+ * as they are, valid UTF-8 stays valid. json_writer batches lines like
+ * text_writer.
+ */
+
+namespace detail {
+
+constexpr char base64_digits [] =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+inline char *
+json_escape(char *out, uint8_t c) noexcept
+{
+	*out++ = '\\';
+	switch(c)
+	{
+		case '"': case '\\':
+			*out++ = char(c);
+			break;
+		case '\n':
+			*out++ = 'n';
+			break;
+		case '\t':
+			*out++ = 't';
+			break;
+		case '\r':
+			*out++ = 'r';
+			break;
+		case '\b':
+			*out++ = 'b';
+			break;
+		case '\f':
+			*out++ = 'f';
+			break;
+		default:
+			std::memcpy(out, "u00", 3);
+			out[3] = hex_digits[c >> 4];
+			out[4] = hex_digits[c & 0xf];
+			out += 5;
+			break;
+	}
+	return out;
+}
+
+constexpr bool
+json_plain(uint8_t c) noexcept
+{
+	return (c >= 0x20) && (c != '"') && (c != '\\');
+}
+
+inline char *
+json_string(char *out, const char *str, size_t len) noexcept
+{
+	*out++ = '"';
+
+#if defined(__SSE2__)
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i control = _mm_set1_epi8(0x1f);
+
+	while(len >= 16)
+	{
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(str));
+		// store ahead, escaped bytes are overwritten below
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(out), v);
+
+		const __m128i esc = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+			_mm_cmpeq_epi8(_mm_max_epu8(v, control), control)); // unsigned <= 0x1f
+		const unsigned mask = _mm_movemask_epi8(esc);
+		if(!mask)
+		{
+			str += 16;
+			out += 16;
+			len -= 16;
+			continue;
+		}
+
+		const unsigned n = __builtin_ctz(mask);
+		out = json_escape(out + n, str[n]);
+		str += n + 1;
+		len -= n + 1;
+	}
+#endif
+
+	for(size_t i = 0; i < len; i++)
+	{
+		const uint8_t c = str[i];
+		if(json_plain(c))
+			*out++ = char(c);
+		else
+			out = json_escape(out, c);
+	}
+
+	*out++ = '"';
+	return out;
+}
+
+#if defined(__SSSE3__)
+// 12 bytes in the low lanes of in to 16 base64 digits
+inline __m128i
+base64_encode12(__m128i in) noexcept
+{
+	// spread 3-byte groups into 32-bit lanes, then 6-bit fields into bytes
+	in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4,
+		1, 2, 0, 1));
+	const __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+	const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+	const __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+	const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+	const __m128i idx = _mm_or_si128(t1, t3);
+
+	// offset from index to digit per range A-Z, a-z, 0-9, +, /
+	const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52,
+		'0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+		'+' - 62, '/' - 63, 'A', 0, 0);
+	__m128i range = _mm_subs_epu8(idx, _mm_set1_epi8(51));
+	const __m128i upper = _mm_cmpgt_epi8(_mm_set1_epi8(26), idx);
+	range = _mm_or_si128(range, _mm_and_si128(upper, _mm_set1_epi8(13)));
+	return _mm_add_epi8(_mm_shuffle_epi8(offsets, range), idx);
+}
+#endif
+
+inline char *
+json_base64(char *out, const uint8_t *src, size_t len) noexcept
+{
+	*out++ = '"';
+
+#if defined(__SSSE3__)
+	// loads 16 bytes, consumes 12
+	while(len >= 16)
+	{
+		const __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(out), base64_encode12(in));
+		src += 12;
+		len -= 12;
+		out += 16;
+	}
+#endif
+
+	for( ; len >= 3; src += 3, len -= 3)
+	{
+		const uint32_t v = (uint32_t(src[0]) << 16) | (uint32_t(src[1]) << 8) | src[2];
+		*out++ = base64_digits[(v >> 18) & 0x3f];
+		*out++ = base64_digits[(v >> 12) & 0x3f];
+		*out++ = base64_digits[(v >> 6) & 0x3f];
+		*out++ = base64_digits[v & 0x3f];
+	}
+
+	if(len)
+	{
+		const uint32_t v = (uint32_t(src[0]) << 16) | ((len == 2) ? uint32_t(src[1]) << 8 : 0);
+		*out++ = base64_digits[(v >> 18) & 0x3f];
+		*out++ = base64_digits[(v >> 12) & 0x3f];
+		*out++ = (len == 2) ? base64_digits[(v >> 6) & 0x3f] : '=';
+		*out++ = '=';
+	}
+
+	*out++ = '"';
+	return out;
+}
+
+// Unix seconds with nanosecond digits
+inline char *
+json_time(char *out, osc_time_t t) noexcept
+{
+	if(t == OSC_IMMEDIATE)
+	{
+		std::memcpy(out, "null", 4);
+		return out + 4;
+	}
+
+	int64_t sec = int64_t(t >> 32) - int64_t(OSC_TIME_EPOCH);
+	uint32_t nsec = osc_time_frac_to_nsec(t & 0xffffffff);
+	if(sec < 0) // before 1970, fraction counts towards zero
+	{
+		*out++ = '-';
+		if(nsec)
+		{
+			sec++;
+			nsec = 1000000000 - nsec;
+		}
+		sec = -sec;
+	}
+
+	out = std::to_chars(out, out + 20, sec).ptr;
+	*out++ = '.';
+	for(int i = 8; i >= 0; i--, nsec /= 10)
+		out[i] = '0' + nsec % 10;
+	return out + 9;
+}
+
+template<typename T>
+inline char *
+json_float(char *out, T v) noexcept
+{
+	if(!std::isfinite(v))
+	{
+		std::memcpy(out, "null", 4);
+		return out + 4;
+	}
+	return std::to_chars(out, out + 24, v).ptr;
+}
+
+inline char *
+json_message(char *out, const message_view &msg, const osc_time_t *time) noexcept
+{
+	if(!msg.header_valid())
+		return nullptr;
+
+	const std::string_view path = msg.path();
+	const std::string_view format = msg.format();
+	const std::span<const std::byte> buf = msg.data();
+
+	*out++ = '{';
+	if(time)
+	{
+		std::memcpy(out, "\"time\":", 7);
+		out = json_time(out + 7, *time);
+		*out++ = ',';
+	}
+	std::memcpy(out, "\"path\":", 7);
+	out = json_string(out + 7, path.data(), path.size());
+	std::memcpy(out, ",\"types\":", 9);
+	out = json_string(out + 9, format.data(), format.size());
+	std::memcpy(out, ",\"args\":[", 9);
+	out += 9;
+
+	bool first = true;
+	unsigned depth = 0; // of OSC arrays, must balance
+	size_t off = padded(path.size() + 1) + padded(format.size() + 2);
+	for(const char type : format)
+	{
+		const size_t size = (off <= buf.size())
+			? arg_size(type, buf.subspan(off)) : npos;
+		if(size == npos)
+			return nullptr;
+
+		const std::byte *ptr = buf.data() + off;
+		off += size;
+
+		if(type == OSC_ACLOSE)
+		{
+			if(!depth--)
+				return nullptr;
+			*out++ = ']';
+			first = false;
+			continue;
+		}
+
+		if(!first)
+			*out++ = ',';
+		first = false;
+
+		switch(type)
+		{
+			case OSC_INT32:
+				out = std::to_chars(out, out + 11, int32_t(load32(ptr))).ptr;
+				break;
+			case OSC_INT64:
+				out = std::to_chars(out, out + 20, int64_t(load64(ptr))).ptr;
+				break;
+			case OSC_FLOAT:
+				out = json_float(out, std::bit_cast<float>(load32(ptr)));
+				break;
+			case OSC_DOUBLE:
+				out = json_float(out, std::bit_cast<double>(load64(ptr)));
+				break;
+			case OSC_TIMETAG:
+				out = json_time(out, load64(ptr));
+				break;
+			case OSC_STRING: case OSC_SYMBOL:
+				out = json_string(out, reinterpret_cast<const char *>(ptr),
+					std::strlen(reinterpret_cast<const char *>(ptr)));
+				break;
+			case OSC_CHAR:
+			{
+				const char c = char(load32(ptr));
+				out = json_string(out, &c, 1);
+				break;
+			}
+			case OSC_BLOB:
+				out = json_base64(out, reinterpret_cast<const uint8_t *>(ptr + 4),
+					load32(ptr));
+				break;
+			case OSC_TRUE:
+				std::memcpy(out, "true", 4);
+				out += 4;
+				break;
+			case OSC_FALSE:
+				std::memcpy(out, "false", 5);
+				out += 5;
+				break;
+			case OSC_NIL: case OSC_BANG:
+				std::memcpy(out, "null", 4);
+				out += 4;
+				break;
+			case OSC_MIDI:
+			{
+				*out++ = '[';
+				for(int i = 0; i < 4; i++)
+				{
+					if(i)
+						*out++ = ',';
+					out = std::to_chars(out, out + 3, uint8_t(ptr[i])).ptr;
+				}
+				*out++ = ']';
+				break;
+			}
+			case OSC_RGBA:
+			{
+				const uint32_t v = load32(ptr);
+				*out++ = '"';
+				*out++ = '#';
+				for(int i = 7; i >= 0; i--)
+					*out++ = hex_digits[(v >> (4*i)) & 0xf];
+				*out++ = '"';
+				break;
+			}
+			case OSC_AOPEN:
+				*out++ = '[';
+				first = true;
+				depth++;
+				break;
+			default:
+				return nullptr;
+		}
+	}
+
+	if( (off != buf.size()) || depth)
+		return nullptr;
+
+	*out++ = ']';
+	*out++ = '}';
+	*out++ = '\n';
+	return out;
+}
+
+inline char *
+json_bundle(char *out, const bundle_view &bndl) noexcept
+{
+	if(!bndl.valid())
+		return nullptr;
+
+	const osc_time_t time = bndl.time();
+
+	std::span<const std::byte> rest = bndl.data().subspan(16);
+	while(!rest.empty())
+	{
+		if(rest.size() < 4)
+			return nullptr;
+		const int32_t len = int32_t(load32(rest.data()));
+		if( (len <= 0) || (size_t(len) > rest.size() - 4) )
+			return nullptr;
+
+		const auto item = rest.subspan(4, len);
+		if(item[0] == std::byte{'/'})
+			out = json_message(out, message_view(item), &time);
+		else if(item[0] == std::byte{'#'})
+			out = json_bundle(out, bundle_view(item));
+		else
+			return nullptr;
+		if(!out)
+			return nullptr;
+
+		rest = rest.subspan(4 + len);
+	}
+
+	return out;
+}
+
+} // namespace detail
+
+// worst-case NDJSON size of a packet of size bytes
+constexpr size_t
+json_bound(size_t size) noexcept
+{
+	return 16*size + 64;
+}
+
+// packet as NDJSON lines, out must hold json_bound(packet.size()) bytes,
+// returns end of text or nullptr if packet is malformed
+inline char *
+to_json(std::span<const std::byte> packet, char *out) noexcept
+{
+	if(packet.empty())
+		return nullptr;
+
+	switch(packet[0])
+	{
+		case std::byte{'/'}:
+			return detail::json_message(out, message_view(packet), nullptr);
+		case std::byte{'#'}:
+			return detail::json_bundle(out, bundle_view(packet));
+		default:
+			return nullptr;
+	}
+}
+
+// NDJSON collected in caller storage, sink(const char *, size_t) is called
+// with full batches and on flush
+template<typename Sink>
+class json_writer
+{
+public:
+	json_writer(std::span<char> storage, Sink sink) noexcept
+		: buf_(storage), sink_(std::move(sink))
+	{}
+
+	json_writer(const json_writer &) = delete;
+	json_writer &operator=(const json_writer &) = delete;
+
+	~json_writer()
+	{
+		flush();
+	}
+
+	// false if packet is malformed or its lines might not fit storage
+	bool
+	write(std::span<const std::byte> packet)
+	{
+		const size_t bound = json_bound(packet.size());
+		if(bound > buf_.size())
+		{
+			too_large_++;
+			return false;
+		}
+		if(bound > buf_.size() - size_)
+			flush();
+
+		char *end = to_json(packet, buf_.data() + size_);
+		if(!end)
+		{
+			malformed_++;
+			return false;
+		}
+
+		size_ = end - buf_.data();
+		packets_++;
+		return true;
+	}
+
+	bool
+	write(const osc_data_t *buf, size_t size)
+	{
+		return write({reinterpret_cast<const std::byte *>(buf), size});
+	}
+
+	void
+	flush()
+	{
+		if(size_)
+			sink_(buf_.data(), size_);
+		size_ = 0;
+	}
+
+	size_t
+	packets() const noexcept
+	{
+		return packets_;
+	}
+
+	size_t
+	malformed() const noexcept
+	{
+		return malformed_;
+	}
+
+	size_t
+	too_large() const noexcept
+	{
+		return too_large_;
+	}
+
+private:
+	std::span<char> buf_;
+	Sink sink_;
+	size_t size_ = 0;
+	size_t packets_ = 0;
+	size_t malformed_ = 0;
+	size_t too_large_ = 0;
+};
+
+} // namespace osc
+
+#endif /* _LIB_OSC_JSON_HPP_ */
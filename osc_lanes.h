@@ -0,0 +1,441 @@
+/*
+ * Copyright (c) 2015 Hanspeter Portner (dev@open-music-kontrollers.ch)
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the Artistic License 2.0 as published by
+ * The Perl Foundation.
+ *
+ * This source is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * Artistic License 2.0 for more details.
+ *
+ * You should have received a copy of the Artistic License 2.0
+ * along the source as a COPYING file. If not, obtain it from
+ * http://www.perlfoundation.org/artistic_license_2_0.
+ */
+
+#ifndef _LIB_OSC_LANES_H_
+#define _LIB_OSC_LANES_H_
+
+#include <stdatomic.h>
+
+#include "osc.h"
+#include "osc_schema.h"
+
+/*
+ * Priority ingest lanes.
+ *
+ * Received packets are sorted into lanes, each a bounded lock-free
+ * single-producer single-consumer ring in caller storage, so bulk traffic
+ * can no longer queue up in front of control messages. Lanes are chosen by
+ * the first matching address prefix rule, else by the lane field of the
+ * message's schema, set with OSC_SCHEMA_LANE, else the fallback lane.
+ * Prefixes match whole path components, /ctl matches /ctl/gain but not
+ * /ctlx. Lanes named by a rule or schema but never added map to the
+ * fallback lane. Bundles go whole
+ * into the lane of their first message. A full lane drops the packet and
+ * counts it, packets for a lane that does not exist count as unrouted.
+ *
+ * osc_lanes_poll hands queued packets to a callback, typically wrapping
+ * osc_dispatch_method, picking each one by:
+ *
+ * 1. strict lanes, lowest index first, are always served first
+ * 2. weighted lanes whose oldest packet has waited past the lane's latency
+ *    budget, earliest deadline first
+ * 3. weighted lanes round-robin, weight packets per lane and round
+ *
+ * One thread ingests, one polls, others may read statistics. Times are in
+ * nanoseconds of a monotonic clock, e.g. osc_rt_now, sampled by the caller:
+ * latencies are measured against the now given to osc_lanes_poll.
+ */
+
+#ifndef OSC_LANES_MAX
+#	define OSC_LANES_MAX 8
+#endif
+
+#define OSC_LANES_WRAP UINT32_MAX // record size marking unused ring tail
+
+typedef enum _osc_lane_policy_t {
+	OSC_LANE_STRICT,
+	OSC_LANE_WEIGHTED
+} osc_lane_policy_t;
+
+typedef void (*osc_lanes_dispatch_cb_t)(unsigned lane, const osc_data_t *buf,
+	size_t size, void *data);
+
+typedef struct _osc_lane_rule_t osc_lane_rule_t;
+typedef struct _osc_lane_t osc_lane_t;
+typedef struct _osc_lane_stats_t osc_lane_stats_t;
+typedef struct _osc_lanes_t osc_lanes_t;
+typedef struct _osc_lane_record_t osc_lane_record_t;
+
+struct _osc_lane_rule_t {
+	const char *prefix; // NULL terminates rules
+	unsigned lane;
+};
+
+struct _osc_lane_record_t {
+	uint32_t size; // of packet, or OSC_LANES_WRAP
+	uint32_t pad;
+	uint64_t stamp; // enqueue time
+};
+
+struct _osc_lane_t {
+	// producer
+	atomic_size_t head;
+	size_t tail_cache;
+	uint8_t pad1 [64 - sizeof(atomic_size_t) - sizeof(size_t)];
+
+	// consumer
+	atomic_size_t tail;
+	size_t head_cache;
+	uint8_t pad2 [64 - sizeof(atomic_size_t) - sizeof(size_t)];
+
+	uint8_t *buf;
+	size_t capacity; // power of two
+	osc_lane_policy_t policy;
+	unsigned weight;
+	uint64_t budget; // 0 for none
+	unsigned credit;
+
+	// statistics
+	atomic_ulong enqueued;
+	atomic_ulong dropped;
+	atomic_ulong dispatched;
+	atomic_ulong misses; // dispatched after budget
+	atomic_ulong latency_sum;
+	atomic_ulong latency_max;
+};
+
+struct _osc_lane_stats_t {
+	unsigned long depth; // queued packets
+	unsigned long bytes; // ring bytes in use
+	unsigned long enqueued;
+	unsigned long dropped;
+	unsigned long dispatched;
+	unsigned long misses;
+	unsigned long latency_avg;
+	unsigned long latency_max;
+};
+
+struct _osc_lanes_t {
+	osc_lane_t lanes [OSC_LANES_MAX];
+	unsigned nlanes;
+
+	const osc_lane_rule_t *rules;
+	const osc_schema_registry_t *schemas;
+	unsigned fallback;
+	atomic_ulong unrouted; // pushed to a lane that does not exist
+
+	unsigned next; // round-robin position
+};
+
+// rules and schemas may be NULL
+static inline void
+osc_lanes_init(osc_lanes_t *lanes, const osc_lane_rule_t *rules,
+	const osc_schema_registry_t *schemas, unsigned fallback)
+{
+	lanes->nlanes = 0;
+	lanes->rules = rules;
+	lanes->schemas = schemas;
+	lanes->fallback = fallback;
+	atomic_init(&lanes->unrouted, 0);
+	lanes->next = 0;
+}
+
+// storage must be 8-byte aligned with a power-of-two size, returns lane
+// index or -1
+static inline int
+osc_lanes_add(osc_lanes_t *lanes, void *storage, size_t size,
+	osc_lane_policy_t policy, unsigned weight, uint64_t budget)
+{
+	if( (lanes->nlanes == OSC_LANES_MAX) || (size < 64) || (size & (size - 1)) )
+		return -1;
+
+	osc_lane_t *lane = &lanes->lanes[lanes->nlanes];
+	atomic_init(&lane->head, 0);
+	atomic_init(&lane->tail, 0);
+	lane->tail_cache = 0;
+	lane->head_cache = 0;
+	lane->buf = (uint8_t *)storage;
+	lane->capacity = size;
+	lane->policy = policy;
+	lane->weight = weight ? weight : 1;
+	lane->budget = budget;
+	lane->credit = lane->weight;
+
+	atomic_init(&lane->enqueued, 0);
+	atomic_init(&lane->dropped, 0);
+	atomic_init(&lane->dispatched, 0);
+	atomic_init(&lane->misses, 0);
+	atomic_init(&lane->latency_sum, 0);
+	atomic_init(&lane->latency_max, 0);
+
+	return lanes->nlanes++;
+}
+
+static inline unsigned
+_osc_lanes_path(const osc_lanes_t *lanes, const char *path, size_t len)
+{
+	const osc_lane_rule_t *rule;
+	if(lanes->rules)
+	{
+		for(rule=lanes->rules; rule->prefix; rule++)
+		{
+			const size_t n = strlen(rule->prefix);
+			if( (len < n) || strncmp(path, rule->prefix, n) )
+				continue;
+			if( (len == n) || (path[n] == '/') || (n && (rule->prefix[n-1] == '/')) )
+				return (rule->lane < lanes->nlanes) ? rule->lane : lanes->fallback;
+		}
+	}
+
+	if(lanes->schemas)
+	{
+		// first signature of path with a lane annotation
+		const uint32_t hash = osc_hash(path, len);
+		const osc_schema_t *s;
+		for(s=osc_schema_lookup(lanes->schemas->schemas, path, hash); s;
+			s=osc_schema_lookup(s + 1, path, hash))
+		{
+			if(s->lane)
+				return (s->lane - 1 < lanes->nlanes) ? s->lane - 1 : lanes->fallback;
+		}
+	}
+
+	return lanes->fallback;
+}
+
+// lane for packet, by its first message
+static inline unsigned
+osc_lanes_classify(const osc_lanes_t *lanes, const osc_data_t *buf, size_t size)
+{
+	while( (size >= 20) && (*buf == '#') ) // descend into first item
+	{
+		const int32_t len = be32toh(*(const int32_t *)(buf + 16));
+		if( (len <= 0) || ((size_t)len > size - 20) )
+			return lanes->fallback;
+		buf += 20;
+		size = len;
+	}
+
+	if(!size || (*buf != '/') )
+		return lanes->fallback;
+
+	const size_t len = strnlen((const char *)buf, size);
+	if(len == size)
+		return lanes->fallback;
+
+	return _osc_lanes_path(lanes, (const char *)buf, len);
+}
+
+// producer side, returns 1 if queued, 0 if lane is full or invalid
+static inline int
+osc_lanes_push(osc_lanes_t *lanes, unsigned idx, const osc_data_t *buf,
+	size_t size, uint64_t now)
+{
+	if(idx >= lanes->nlanes)
+	{
+		atomic_fetch_add_explicit(&lanes->unrouted, 1, memory_order_relaxed);
+		return 0;
+	}
+
+	osc_lane_t *lane = &lanes->lanes[idx];
+	const size_t need = sizeof(osc_lane_record_t) + ((size + 7) & ~(size_t)7);
+	size_t head = atomic_load_explicit(&lane->head, memory_order_relaxed);
+	const size_t off = head & (lane->capacity - 1);
+	const size_t contig = lane->capacity - off;
+	const size_t total = need + ((contig < need) ? contig : 0); // wrap if needed
+
+	if(head + total - lane->tail_cache > lane->capacity)
+	{
+		lane->tail_cache = atomic_load_explicit(&lane->tail, memory_order_acquire);
+		if( (total > lane->capacity) || (head + total - lane->tail_cache > lane->capacity) )
+		{
+			atomic_fetch_add_explicit(&lane->dropped, 1, memory_order_relaxed);
+			return 0;
+		}
+	}
+
+	osc_lane_record_t *rec = (osc_lane_record_t *)(lane->buf + off);
+	if(contig < need)
+	{
+		rec->size = OSC_LANES_WRAP;
+		head += contig;
+		rec = (osc_lane_record_t *)lane->buf;
+	}
+
+	rec->size = size;
+	rec->stamp = now;
+	memcpy(rec + 1, buf, size);
+
+	atomic_store_explicit(&lane->head, head + need, memory_order_release);
+	atomic_fetch_add_explicit(&lane->enqueued, 1, memory_order_relaxed);
+
+	return 1;
+}
+
+// classify and push, returns lane or -1 if dropped
+static inline int
+osc_lanes_ingest(osc_lanes_t *lanes, const osc_data_t *buf, size_t size,
+	uint64_t now)
+{
+	const unsigned idx = osc_lanes_classify(lanes, buf, size);
+	return osc_lanes_push(lanes, idx, buf, size, now) ? (int)idx : -1;
+}
+
+// consumer side, oldest record of lane or NULL if empty
+static inline const osc_lane_record_t *
+_osc_lane_peek(osc_lane_t *lane)
+{
+	size_t tail = atomic_load_explicit(&lane->tail, memory_order_relaxed);
+
+	if(tail == lane->head_cache)
+	{
+		lane->head_cache = atomic_load_explicit(&lane->head, memory_order_acquire);
+		if(tail == lane->head_cache)
+			return NULL;
+	}
+
+	const size_t off = tail & (lane->capacity - 1);
+	const osc_lane_record_t *rec = (const osc_lane_record_t *)(lane->buf + off);
+	if(rec->size == OSC_LANES_WRAP)
+	{
+		// producer has published the record after the wrap along with it
+		tail += lane->capacity - off;
+		atomic_store_explicit(&lane->tail, tail, memory_order_release);
+		rec = (const osc_lane_record_t *)lane->buf;
+	}
+
+	return rec;
+}
+
+static inline void
+_osc_lane_pop(osc_lane_t *lane, const osc_lane_record_t *rec, uint64_t now)
+{
+	const uint64_t latency = (now > rec->stamp) ? now - rec->stamp : 0;
+	const size_t need = sizeof(osc_lane_record_t) + ((rec->size + 7) & ~(size_t)7);
+	const size_t tail = atomic_load_explicit(&lane->tail, memory_order_relaxed);
+	atomic_store_explicit(&lane->tail, tail + need, memory_order_release);
+
+	// single consumer, plain read-modify-write is enough
+	atomic_store_explicit(&lane->dispatched,
+		atomic_load_explicit(&lane->dispatched, memory_order_relaxed) + 1,
+		memory_order_relaxed);
+	atomic_store_explicit(&lane->latency_sum,
+		atomic_load_explicit(&lane->latency_sum, memory_order_relaxed) + latency,
+		memory_order_relaxed);
+	if(latency > atomic_load_explicit(&lane->latency_max, memory_order_relaxed))
+		atomic_store_explicit(&lane->latency_max, latency, memory_order_relaxed);
+	if(lane->budget && (latency > lane->budget) )
+		atomic_fetch_add_explicit(&lane->misses, 1, memory_order_relaxed);
+}
+
+static inline int
+_osc_lanes_pick(osc_lanes_t *lanes, uint64_t now)
+{
+	unsigned i;
+	int overdue = -1;
+	uint64_t earliest = UINT64_MAX;
+	int pending = 0;
+
+	for(i=0; i<lanes->nlanes; i++)
+	{
+		osc_lane_t *lane = &lanes->lanes[i];
+		const osc_lane_record_t *rec = _osc_lane_peek(lane);
+		if(!rec)
+			continue;
+
+		if(lane->policy == OSC_LANE_STRICT)
+			return i;
+
+		pending = 1;
+		if(lane->budget && (rec->stamp + lane->budget <= now)
+				&& (rec->stamp + lane->budget < earliest) )
+		{
+			earliest = rec->stamp + lane->budget;
+			overdue = i;
+		}
+	}
+
+	if(overdue >= 0)
+		return overdue;
+	if(!pending)
+		return -1;
+
+	// round robin over weighted lanes with credit left, refill once
+	unsigned round;
+	for(round=0; round<2; round++)
+	{
+		unsigned k;
+		for(k=0; k<lanes->nlanes; k++)
+		{
+			const unsigned j = (lanes->next + k) % lanes->nlanes;
+			osc_lane_t *lane = &lanes->lanes[j];
+			if( (lane->policy != OSC_LANE_WEIGHTED) || !lane->credit
+					|| !_osc_lane_peek(lane) )
+				continue;
+
+			if(--lane->credit == 0)
+				lanes->next = j + 1;
+			return j;
+		}
+
+		for(k=0; k<lanes->nlanes; k++)
+			lanes->lanes[k].credit = lanes->lanes[k].weight;
+	}
+
+	return -1;
+}
+
+// dispatch up to max queued packets, returns number dispatched
+static inline unsigned
+osc_lanes_poll(osc_lanes_t *lanes, uint64_t now, unsigned max,
+	osc_lanes_dispatch_cb_t cb, void *data)
+{
+	unsigned n;
+	for(n=0; n<max; n++)
+	{
+		const int idx = _osc_lanes_pick(lanes, now);
+		if(idx < 0)
+			break;
+
+		osc_lane_t *lane = &lanes->lanes[idx];
+		const osc_lane_record_t *rec = _osc_lane_peek(lane);
+		cb(idx, (const osc_data_t *)(rec + 1), rec->size, data);
+		_osc_lane_pop(lane, rec, now);
+	}
+
+	return n;
+}
+
+// snapshot, safe from any thread
+static inline void
+osc_lanes_stats(osc_lanes_t *lanes, unsigned idx, osc_lane_stats_t *stats)
+{
+	osc_lane_t *lane = &lanes->lanes[idx];
+
+	stats->dispatched = atomic_load_explicit(&lane->dispatched, memory_order_relaxed);
+	stats->enqueued = atomic_load_explicit(&lane->enqueued, memory_order_relaxed);
+	stats->dropped = atomic_load_explicit(&lane->dropped, memory_order_relaxed);
+	stats->misses = atomic_load_explicit(&lane->misses, memory_order_relaxed);
+	stats->latency_max = atomic_load_explicit(&lane->latency_max, memory_order_relaxed);
+	stats->latency_avg = stats->dispatched
+		? atomic_load_explicit(&lane->latency_sum, memory_order_relaxed) / stats->dispatched
+		: 0;
+
+	const size_t tail = atomic_load_explicit(&lane->tail, memory_order_relaxed);
+	const size_t head = atomic_load_explicit(&lane->head, memory_order_relaxed);
+	stats->bytes = head - tail;
+	stats->depth = (stats->enqueued > stats->dispatched)
+		? stats->enqueued - stats->dispatched : 0;
+}
+
+static inline unsigned long
+osc_lanes_unrouted(osc_lanes_t *lanes)
+{
+	return atomic_load_explicit(&lanes->unrouted, memory_order_relaxed);
+}
+
+#endif /* _LIB_OSC_LANES_H_ */
@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2015 Hanspeter Portner (dev@open-music-kontrollers.ch)
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the Artistic License 2.0 as published by
+ * The Perl Foundation.
+ *
+ * This source is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * Artistic License 2.0 for more details.
+ *
+ * You should have received a copy of the Artistic License 2.0
+ * along the source as a COPYING file. If not, obtain it from
+ * http://www.perlfoundation.org/artistic_license_2_0.
+ */
+
+#ifndef _LIB_OSC_MERGE_H_
+#define _LIB_OSC_MERGE_H_
+
+#include "osc.h"
+
+/*
+ * Timetag-ordered k-way merge of packet sources.
+ *
+ * Each source hands out one packet at a time via its pull callback; the
+ * packet must stay valid until the next pull on the same source. Messages
+ * count as OSC_IMMEDIATE, bundles by their header timetag, ties go to the
+ * source with the lower index. Sources and tree nodes are caller-provided,
+ * so merging never allocates.
+ */
+
+typedef const osc_data_t *(*osc_merge_pull_cb_t)(size_t *size, void *data);
+typedef struct _osc_merge_source_t osc_merge_source_t;
+typedef struct _osc_merge_t osc_merge_t;
+
+struct _osc_merge_source_t {
+	osc_merge_pull_cb_t pull;
+	void *data;
+
+	const osc_data_t *buf;
+	size_t size;
+	osc_time_t time;
+};
+
+struct _osc_merge_t {
+	osc_merge_source_t *sources;
+	size_t *tree; // tree[0] is the winner, tree[1..n-1] the losers
+	size_t n;
+	size_t last; // source to refill on next call
+};
+
+// get timetag of a packet, messages are immediate
+static inline osc_time_t
+osc_get_packet_time(const osc_data_t *buf)
+{
+	osc_time_t time = OSC_IMMEDIATE;
+
+	if(*buf == '#')
+		osc_get_bundle(buf, &time);
+
+	return time;
+}
+
+static inline void
+_osc_merge_refill(osc_merge_source_t *src)
+{
+	src->buf = src->pull(&src->size, src->data);
+	if(src->buf)
+		src->time = osc_get_packet_time(src->buf);
+}
+
+// does source a win against source b?
+static inline int
+_osc_merge_less(const osc_merge_t *merge, size_t a, size_t b)
+{
+	const osc_merge_source_t *sa = &merge->sources[a];
+	const osc_merge_source_t *sb = &merge->sources[b];
+
+	if(!sa->buf) // exhausted sources always lose
+		return 0;
+	if(!sb->buf)
+		return 1;
+	if(sa->time != sb->time)
+		return sa->time < sb->time;
+	return a < b;
+}
+
+// play subtree rooted at node t, store losers, return winner
+static inline size_t
+_osc_merge_build(osc_merge_t *merge, size_t t)
+{
+	if(t >= merge->n) // leaf
+		return t - merge->n;
+
+	size_t a = _osc_merge_build(merge, 2*t);
+	size_t b = _osc_merge_build(merge, 2*t + 1);
+
+	if(_osc_merge_less(merge, a, b))
+	{
+		merge->tree[t] = b;
+		return a;
+	}
+
+	merge->tree[t] = a;
+	return b;
+}
+
+// replay path from leaf s up to the root
+static inline void
+_osc_merge_replay(osc_merge_t *merge, size_t s)
+{
+	size_t t;
+	for(t=(s + merge->n)/2; t>0; t/=2)
+	{
+		if(_osc_merge_less(merge, merge->tree[t], s))
+		{
+			size_t tmp = merge->tree[t];
+			merge->tree[t] = s;
+			s = tmp;
+		}
+	}
+	merge->tree[0] = s;
+}
+
+// replace the packet handed out by the previous call
+static inline void
+_osc_merge_advance(osc_merge_t *merge)
+{
+	if(merge->last >= merge->n)
+		return;
+
+	_osc_merge_refill(&merge->sources[merge->last]);
+	_osc_merge_replay(merge, merge->last);
+	merge->last = merge->n;
+}
+
+// sources and tree must hold n elements each, pull and data set per source
+static inline int
+osc_merge_init(osc_merge_t *merge, osc_merge_source_t *sources, size_t *tree,
+	size_t n)
+{
+	if(!n)
+		return 0;
+
+	merge->sources = sources;
+	merge->tree = tree;
+	merge->n = n;
+	merge->last = n;
+
+	size_t i;
+	for(i=0; i<n; i++)
+		_osc_merge_refill(&sources[i]);
+
+	tree[0] = _osc_merge_build(merge, 1);
+
+	return 1;
+}
+
+// get next packet in timetag order, returns source index or -1 when drained
+static inline int
+osc_merge_next(osc_merge_t *merge, const osc_data_t **buf, size_t *size)
+{
+	_osc_merge_advance(merge);
+
+	size_t w = merge->tree[0];
+	const osc_merge_source_t *src = &merge->sources[w];
+	if(!src->buf)
+		return -1;
+
+	*buf = src->buf;
+	*size = src->size;
+	merge->last = w;
+
+	return w;
+}
+
+// timetag of the packet osc_merge_next will return next, for schedulers;
+// like osc_merge_next it releases the previously returned packet
+static inline int
+osc_merge_peek(osc_merge_t *merge, osc_time_t *time)
+{
+	_osc_merge_advance(merge);
+
+	const osc_merge_source_t *src = &merge->sources[merge->tree[0]];
+	if(!src->buf)
+		return 0;
+
+	*time = src->time;
+	return 1;
+}
+
+// dispatch merged packets with timetags up to and including until
+static inline size_t
+osc_merge_dispatch(osc_merge_t *merge, osc_time_t until,
+	const osc_method_t *methods, osc_bundle_in_cb_t bundle_in,
+	osc_bundle_out_cb_t bundle_out, void *data)
+{
+	size_t count = 0;
+	osc_time_t time;
+
+	while(osc_merge_peek(merge, &time) && (time <= until) )
+	{
+		const osc_data_t *buf;
+		size_t size;
+
+		osc_merge_next(merge, &buf, &size);
+		osc_dispatch_method(buf, size, methods, bundle_in, bundle_out, data);
+		count++;
+	}
+
+	return count;
+}
+
+#endif /* _LIB_OSC_MERGE_H_ */
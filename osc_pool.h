@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2015 Hanspeter Portner (dev@open-music-kontrollers.ch)
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the Artistic License 2.0 as published by
+ * The Perl Foundation.
+ *
+ * This source is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * Artistic License 2.0 for more details.
+ *
+ * You should have received a copy of the Artistic License 2.0
+ * along the source as a COPYING file. If not, obtain it from
+ * http://www.perlfoundation.org/artistic_license_2_0.
+ */
+
+#ifndef _LIB_OSC_POOL_H_
+#define _LIB_OSC_POOL_H_
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+/*
+ * Small worker pool.
+ *
+ * osc_pool_run calls a job callback for job indices 0 to njobs-1, spread
+ * over the pool threads and the calling thread, and returns once all jobs
+ * are done. Jobs are claimed one at a time from a shared counter, so uneven
+ * jobs balance out. Runs must not overlap, i.e. only one thread may call
+ * osc_pool_run at a time and not from within a job. A NULL pool or a pool
+ * without threads runs all jobs on the calling thread.
+ */
+
+#ifndef OSC_POOL_THREADS
+#	define OSC_POOL_THREADS 8
+#endif
+
+typedef void (*osc_pool_job_cb_t)(unsigned job, void *data);
+
+typedef struct _osc_pool_t osc_pool_t;
+
+struct _osc_pool_t {
+	pthread_t threads [OSC_POOL_THREADS];
+	unsigned nthreads;
+
+	pthread_mutex_t lock;
+	pthread_cond_t wake; // workers wait for next run
+	pthread_cond_t idle; // caller waits for workers to leave run
+	unsigned long run; // incremented per run
+	unsigned busy; // workers within current run
+	int quit;
+
+	// current run
+	osc_pool_job_cb_t cb;
+	void *data;
+	unsigned njobs;
+	atomic_uint next; // next job to claim
+};
+
+// run parameters are passed in, they were read under the lock
+static inline void
+_osc_pool_work(osc_pool_t *pool, osc_pool_job_cb_t cb, void *data,
+	unsigned njobs)
+{
+	unsigned job;
+	while( (job = atomic_fetch_add_explicit(&pool->next, 1, memory_order_relaxed))
+			< njobs)
+		cb(job, data);
+}
+
+static inline void *
+_osc_pool_worker(void *arg)
+{
+	osc_pool_t *pool = (osc_pool_t *)arg;
+	unsigned long seen = 0;
+
+	pthread_mutex_lock(&pool->lock);
+	for(;;)
+	{
+		while(!pool->quit && (pool->run == seen) )
+			pthread_cond_wait(&pool->wake, &pool->lock);
+		if(pool->quit)
+			break;
+
+		seen = pool->run;
+		pool->busy++;
+		const osc_pool_job_cb_t cb = pool->cb;
+		void *data = pool->data;
+		const unsigned njobs = pool->njobs;
+		pthread_mutex_unlock(&pool->lock);
+
+		_osc_pool_work(pool, cb, data, njobs);
+
+		pthread_mutex_lock(&pool->lock);
+		if(--pool->busy == 0)
+			pthread_cond_signal(&pool->idle);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+// nthreads is the number of extra threads besides the calling one
+static inline int
+osc_pool_init(osc_pool_t *pool, unsigned nthreads)
+{
+	if(nthreads > OSC_POOL_THREADS)
+		nthreads = OSC_POOL_THREADS;
+
+	pool->nthreads = 0;
+	pool->run = 0;
+	pool->busy = 0;
+	pool->quit = 0;
+	pool->njobs = 0;
+	atomic_init(&pool->next, 0);
+
+	if(pthread_mutex_init(&pool->lock, NULL))
+		return 0;
+	pthread_cond_init(&pool->wake, NULL);
+	pthread_cond_init(&pool->idle, NULL);
+
+	for( ; pool->nthreads<nthreads; pool->nthreads++)
+		if(pthread_create(&pool->threads[pool->nthreads], NULL, _osc_pool_worker, pool))
+			break; // run with fewer threads
+
+	return 1;
+}
+
+static inline void
+osc_pool_deinit(osc_pool_t *pool)
+{
+	pthread_mutex_lock(&pool->lock);
+	pool->quit = 1;
+	pthread_cond_broadcast(&pool->wake);
+	pthread_mutex_unlock(&pool->lock);
+
+	unsigned i;
+	for(i=0; i<pool->nthreads; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	pthread_cond_destroy(&pool->idle);
+	pthread_cond_destroy(&pool->wake);
+	pthread_mutex_destroy(&pool->lock);
+}
+
+static inline void
+osc_pool_run(osc_pool_t *pool, unsigned njobs, osc_pool_job_cb_t cb, void *data)
+{
+	if(!pool || !pool->nthreads || (njobs < 2) )
+	{
+		unsigned job;
+		for(job=0; job<njobs; job++)
+			cb(job, data);
+		return;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->cb = cb;
+	pool->data = data;
+	pool->njobs = njobs;
+	atomic_store_explicit(&pool->next, 0, memory_order_relaxed);
+	pool->run++;
+	pthread_cond_broadcast(&pool->wake);
+	pthread_mutex_unlock(&pool->lock);
+
+	_osc_pool_work(pool, cb, data, njobs);
+
+	// all jobs are claimed, wait for workers still running theirs
+	pthread_mutex_lock(&pool->lock);
+	while(pool->busy)
+		pthread_cond_wait(&pool->idle, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+#endif /* _LIB_OSC_POOL_H_ */
@@ -0,0 +1,393 @@
+/*
+ * Copyright (c) 2015 Hanspeter Portner (dev@open-music-kontrollers.ch)
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the Artistic License 2.0 as published by
+ * The Perl Foundation.
+ *
+ * This source is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * Artistic License 2.0 for more details.
+ *
+ * You should have received a copy of the Artistic License 2.0
+ * along the source as a COPYING file. If not, obtain it from
+ * http://www.perlfoundation.org/artistic_license_2_0.
+ */
+
+#ifndef _LIB_OSC_PUBLISH_H_
+#define _LIB_OSC_PUBLISH_H_
+
+#include <errno.h>
+
+#include "osc.h"
+
+#if !defined(__WINDOWS__)
+#	include <sys/socket.h>
+#	include <sys/uio.h>
+#endif
+
+/*
+ * Fan-out publisher.
+ *
+ * Subscribers are datagram destinations on one socket, each subscribes to
+ * address prefixes ending with '/' or to full paths. Subscriptions live in
+ * an open-addressing table keyed by prefix, publishing looks up the path
+ * once per '/' boundary plus once as a whole, so the cost depends on the
+ * path depth, not on the number of subscribers. A packet is encoded once
+ * and the same buffer goes to every matching subscriber, on Linux in
+ * batches of OSC_PUBLISH_BATCH through sendmmsg (needs _GNU_SOURCE), else
+ * through one sendto per subscriber. Sends failing with EAGAIN or ENOBUFS
+ * count as dropped, other failures as errors. Prefix strings are
+ * referenced, not copied.
+ */
+
+#ifndef OSC_PUBLISH_BATCH
+#	define OSC_PUBLISH_BATCH 64
+#endif
+
+#if defined(__linux__) && defined(_GNU_SOURCE)
+#	define OSC_PUBLISH_MMSG
+#endif
+
+#define OSC_PUBLISH_FREE -1
+
+typedef struct _osc_subscriber_t osc_subscriber_t;
+typedef struct _osc_subscription_t osc_subscription_t;
+typedef struct _osc_publisher_t osc_publisher_t;
+
+struct _osc_subscriber_t {
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	int active;
+	uint32_t mark; // last publish this subscriber was picked for
+
+	uint32_t sent;
+	uint32_t dropped; // backpressure, socket buffer full
+	uint32_t errors;
+};
+
+struct _osc_subscription_t {
+	const char *prefix;
+	uint32_t hash;
+	uint32_t len;
+	int32_t subscriber; // or OSC_PUBLISH_FREE
+};
+
+struct _osc_publisher_t {
+	int fd;
+
+	osc_subscriber_t *subscribers;
+	uint32_t max;
+
+	osc_subscription_t *table;
+	uint32_t mask;
+	uint32_t used;
+
+	uint32_t seq;
+	uint32_t published; // packets
+};
+
+typedef struct _osc_publish_batch_t osc_publish_batch_t;
+
+struct _osc_publish_batch_t {
+	struct iovec iov;
+	unsigned count; // queued, not yet sent
+	uint32_t total;
+	int32_t ids [OSC_PUBLISH_BATCH];
+#if defined(OSC_PUBLISH_MMSG)
+	struct mmsghdr msgs [OSC_PUBLISH_BATCH];
+#endif
+};
+
+// table must hold nslots entries, nslots a power of two
+static inline int
+osc_publisher_init(osc_publisher_t *pub, int fd, osc_subscriber_t *subscribers,
+	uint32_t max, osc_subscription_t *table, uint32_t nslots)
+{
+	if(!nslots || (nslots & (nslots - 1)) )
+		return 0;
+
+	pub->fd = fd;
+	pub->subscribers = subscribers;
+	pub->max = max;
+	pub->table = table;
+	pub->mask = nslots - 1;
+	pub->used = 0;
+	pub->seq = 0;
+	pub->published = 0;
+
+	uint32_t i;
+	for(i=0; i<max; i++)
+		subscribers[i].active = 0;
+
+	for(i=0; i<nslots; i++)
+		table[i].subscriber = OSC_PUBLISH_FREE;
+
+	return 1;
+}
+
+// returns subscriber ID or -1 if there is no room left
+static inline int32_t
+osc_publisher_add(osc_publisher_t *pub, const struct sockaddr *addr,
+	socklen_t addrlen)
+{
+	if(addrlen > sizeof(struct sockaddr_storage))
+		return -1;
+
+	uint32_t i;
+	for(i=0; i<pub->max; i++)
+	{
+		osc_subscriber_t *sub = &pub->subscribers[i];
+		if(sub->active)
+			continue;
+
+		memcpy(&sub->addr, addr, addrlen);
+		sub->addrlen = addrlen;
+		sub->active = 1;
+		sub->mark = pub->seq;
+		sub->sent = 0;
+		sub->dropped = 0;
+		sub->errors = 0;
+
+		return i;
+	}
+
+	return -1;
+}
+
+static inline int
+osc_publisher_subscribe(osc_publisher_t *pub, int32_t id, const char *prefix)
+{
+	if( (id < 0) || ((uint32_t)id >= pub->max) || !pub->subscribers[id].active
+			|| (prefix[0] != '/') )
+		return 0;
+
+	const uint32_t len = strlen(prefix);
+	const uint32_t hash = osc_hash(prefix, len);
+
+	uint32_t i;
+	for(i=hash & pub->mask; ; i=(i + 1) & pub->mask)
+	{
+		osc_subscription_t *entry = &pub->table[i];
+
+		if(entry->subscriber == OSC_PUBLISH_FREE)
+		{
+			if(pub->used >= pub->mask) // keep a free slot
+				return 0;
+			pub->used++;
+			break;
+		}
+
+		if( (entry->subscriber == id) && (entry->hash == hash)
+				&& (entry->len == len) && !memcmp(entry->prefix, prefix, len) )
+			return 1; // already subscribed
+	}
+
+	osc_subscription_t *entry = &pub->table[i];
+	entry->prefix = prefix;
+	entry->hash = hash;
+	entry->len = len;
+	entry->subscriber = id;
+
+	return 1;
+}
+
+// free slot i, moving later entries of its probe chain back into the gap,
+// so no deleted markers pile up and fill the table
+static inline void
+_osc_publisher_delete(osc_publisher_t *pub, uint32_t i)
+{
+	uint32_t j;
+	for(j=(i + 1) & pub->mask; ; j=(j + 1) & pub->mask)
+	{
+		const osc_subscription_t *entry = &pub->table[j];
+		if(entry->subscriber == OSC_PUBLISH_FREE)
+			break;
+
+		// entry stays if its home slot lies cyclically in (i, j]
+		const uint32_t home = entry->hash & pub->mask;
+		if( ((j - home) & pub->mask) < ((j - i) & pub->mask) )
+			continue;
+
+		pub->table[i] = *entry;
+		i = j;
+	}
+
+	pub->table[i].subscriber = OSC_PUBLISH_FREE;
+	pub->used--;
+}
+
+// prefix NULL removes all subscriptions of subscriber
+static inline int
+osc_publisher_unsubscribe(osc_publisher_t *pub, int32_t id, const char *prefix)
+{
+	const uint32_t len = prefix ? strlen(prefix) : 0;
+	int removed = 0;
+
+	uint32_t i;
+	for(i=0; i<=pub->mask; )
+	{
+		osc_subscription_t *entry = &pub->table[i];
+
+		if( (entry->subscriber == id) && (!prefix
+				|| ((entry->len == len) && !memcmp(entry->prefix, prefix, len))) )
+		{
+			_osc_publisher_delete(pub, i);
+			removed++;
+			continue; // slot may have been refilled from further on
+		}
+
+		i++;
+	}
+
+	return removed;
+}
+
+static inline void
+osc_publisher_remove(osc_publisher_t *pub, int32_t id)
+{
+	if( (id < 0) || ((uint32_t)id >= pub->max) )
+		return;
+
+	osc_publisher_unsubscribe(pub, id, NULL);
+	pub->subscribers[id].active = 0;
+}
+
+static inline void
+_osc_publish_result(osc_subscriber_t *sub, int err)
+{
+	if(!err)
+		sub->sent++;
+	else if( (err == EAGAIN) || (err == EWOULDBLOCK) || (err == ENOBUFS) )
+		sub->dropped++;
+	else
+		sub->errors++;
+}
+
+static inline void
+_osc_publish_flush(osc_publisher_t *pub, osc_publish_batch_t *batch)
+{
+	unsigned i = 0;
+
+#if defined(OSC_PUBLISH_MMSG)
+	while(i < batch->count)
+	{
+		const int n = sendmmsg(pub->fd, &batch->msgs[i], batch->count - i, 0);
+		if(n < 0) // first message of remainder failed, skip it
+		{
+			_osc_publish_result(&pub->subscribers[batch->ids[i++]], errno);
+			continue;
+		}
+
+		int j;
+		for(j=0; j<n; j++)
+			_osc_publish_result(&pub->subscribers[batch->ids[i++]], 0);
+	}
+#else
+	for( ; i<batch->count; i++)
+	{
+		osc_subscriber_t *sub = &pub->subscribers[batch->ids[i]];
+		const int res = sendto(pub->fd, batch->iov.iov_base, batch->iov.iov_len, 0,
+			(const struct sockaddr *)&sub->addr, sub->addrlen);
+		_osc_publish_result(sub, (res < 0) ? errno : 0);
+	}
+#endif
+
+	batch->count = 0;
+}
+
+// queue subscribers of one prefix or path, skip those already queued
+static inline void
+_osc_publish_collect(osc_publisher_t *pub, osc_publish_batch_t *batch,
+	const char *path, uint32_t len)
+{
+	const uint32_t hash = osc_hash(path, len);
+
+	uint32_t i;
+	for(i=hash & pub->mask; ; i=(i + 1) & pub->mask)
+	{
+		const osc_subscription_t *entry = &pub->table[i];
+
+		if(entry->subscriber == OSC_PUBLISH_FREE)
+			return;
+
+		if( (entry->subscriber < 0) || (entry->hash != hash) || (entry->len != len)
+				|| memcmp(entry->prefix, path, len) )
+			continue;
+
+		osc_subscriber_t *sub = &pub->subscribers[entry->subscriber];
+		if(sub->mark == pub->seq)
+			continue;
+		sub->mark = pub->seq;
+
+#if defined(OSC_PUBLISH_MMSG)
+		struct mmsghdr *msg = &batch->msgs[batch->count];
+		memset(msg, 0, sizeof(struct mmsghdr));
+		msg->msg_hdr.msg_name = &sub->addr;
+		msg->msg_hdr.msg_namelen = sub->addrlen;
+		msg->msg_hdr.msg_iov = &batch->iov;
+		msg->msg_hdr.msg_iovlen = 1;
+#endif
+		batch->ids[batch->count++] = entry->subscriber;
+		batch->total++;
+
+		if(batch->count == OSC_PUBLISH_BATCH)
+			_osc_publish_flush(pub, batch);
+	}
+}
+
+// send encoded packet to all subscribers matching path, returns their number
+static inline uint32_t
+osc_publish(osc_publisher_t *pub, const char *path, const osc_data_t *buf,
+	size_t size)
+{
+	const size_t len = strlen(path);
+	if(!len || (path[0] != '/') )
+		return 0;
+
+	osc_publish_batch_t batch;
+	batch.iov.iov_base = (void *)buf;
+	batch.iov.iov_len = size;
+	batch.count = 0;
+	batch.total = 0;
+
+	if(++pub->seq == 0) // marks of 0 are reserved for new subscribers
+	{
+		uint32_t i;
+		for(i=0; i<pub->max; i++)
+			pub->subscribers[i].mark = 0;
+		pub->seq = 1;
+	}
+
+	// prefixes at every '/' boundary, then the whole path
+	size_t i;
+	for(i=0; i<len; i++)
+		if(path[i] == '/')
+			_osc_publish_collect(pub, &batch, path, i + 1);
+	if(path[len - 1] != '/')
+		_osc_publish_collect(pub, &batch, path, len);
+
+	_osc_publish_flush(pub, &batch);
+	pub->published++;
+
+	return batch.total;
+}
+
+// encode message once into buf and publish it
+static inline uint32_t
+osc_publish_vararg(osc_publisher_t *pub, osc_data_t *buf, const osc_data_t *end,
+	const char *path, const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	osc_data_t *ptr = osc_set_varlist(buf, end, path, fmt, args);
+	va_end(args);
+
+	if(!ptr)
+		return 0;
+
+	return osc_publish(pub, path, buf, ptr - buf);
+}
+
+#endif /* _LIB_OSC_PUBLISH_H_ */
@@ -0,0 +1,279 @@
+/*
+ * Copyright (c) 2015 Hanspeter Portner (dev@open-music-kontrollers.ch)
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the Artistic License 2.0 as published by
+ * The Perl Foundation.
+ *
+ * This source is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * Artistic License 2.0 for more details.
+ *
+ * You should have received a copy of the Artistic License 2.0
+ * along the source as a COPYING file. If not, obtain it from
+ * http://www.perlfoundation.org/artistic_license_2_0.
+ */
+
+#ifndef _LIB_OSC_REGISTRY_H_
+#define _LIB_OSC_REGISTRY_H_
+
+#include <stdlib.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+#include "osc.h"
+
+/*
+ * Hot-swappable method tables.
+ *
+ * Every update builds a new immutable copy of the method table and
+ * publishes it atomically, dispatch threads pick it up with an acquire
+ * load and never block. Replaced tables are reclaimed by epochs once no
+ * dispatch thread can still be walking them.
+ *
+ * Each dispatch thread registers once via osc_registry_reader and must
+ * not dispatch recursively on the same reader from within a callback.
+ * Updates allocate, may wait for lagging readers and must be serialized
+ * by the caller, typically they all happen on one control thread. Path
+ * and format strings are referenced, not copied.
+ */
+
+#ifndef OSC_REGISTRY_READERS
+#	define OSC_REGISTRY_READERS 16
+#endif
+
+#ifndef OSC_REGISTRY_RETIRED
+#	define OSC_REGISTRY_RETIRED 16
+#endif
+
+typedef struct _osc_registry_reader_t osc_registry_reader_t;
+typedef struct _osc_registry_retired_t osc_registry_retired_t;
+typedef struct _osc_registry_t osc_registry_t;
+
+struct _osc_registry_reader_t {
+	atomic_ulong epoch; // 0 while quiescent
+	uint8_t pad [64 - sizeof(atomic_ulong)]; // keep readers on own cache lines
+};
+
+struct _osc_registry_retired_t {
+	osc_method_t *methods;
+	unsigned long epoch;
+};
+
+struct _osc_registry_t {
+	_Atomic(osc_method_t *) methods;
+	atomic_ulong epoch;
+	atomic_uint nreaders;
+
+	osc_registry_reader_t readers [OSC_REGISTRY_READERS];
+
+	// writer only
+	osc_registry_retired_t retired [OSC_REGISTRY_RETIRED];
+	unsigned nretired;
+};
+
+static inline size_t
+_osc_registry_count(const osc_method_t *methods)
+{
+	size_t n = 0;
+
+	if(methods)
+		while(methods[n].cb)
+			n++;
+
+	return n;
+}
+
+// copy n entries into a new table with room for extra entries
+static inline osc_method_t *
+_osc_registry_alloc(const osc_method_t *methods, size_t n, size_t extra)
+{
+	osc_method_t *table = (osc_method_t *)calloc(n + extra + 1,
+		sizeof(osc_method_t));
+	if(table && n)
+		memcpy(table, methods, n * sizeof(osc_method_t));
+	return table;
+}
+
+static inline int
+_osc_registry_streq(const char *a, const char *b)
+{
+	if(!a || !b)
+		return a == b;
+	return !strcmp(a, b);
+}
+
+// reclaim retired tables no reader can see anymore
+static inline void
+osc_registry_collect(osc_registry_t *reg)
+{
+	const unsigned nreaders = atomic_load(&reg->nreaders);
+	unsigned long oldest = atomic_load(&reg->epoch);
+
+	unsigned i;
+	for(i=0; i<nreaders; i++)
+	{
+		const unsigned long epoch = atomic_load(&reg->readers[i].epoch);
+		if(epoch && (epoch < oldest) )
+			oldest = epoch;
+	}
+
+	unsigned j = 0;
+	for(i=0; i<reg->nretired; i++)
+	{
+		if(reg->retired[i].epoch <= oldest)
+			free(reg->retired[i].methods);
+		else
+			reg->retired[j++] = reg->retired[i];
+	}
+	reg->nretired = j;
+}
+
+static inline void
+_osc_registry_publish(osc_registry_t *reg, osc_method_t *methods)
+{
+	while(reg->nretired == OSC_REGISTRY_RETIRED) // readers lagging behind
+	{
+		osc_registry_collect(reg);
+		if(reg->nretired == OSC_REGISTRY_RETIRED)
+			sched_yield(); // only the writer ever waits
+	}
+
+	osc_method_t *old = atomic_exchange(&reg->methods, methods);
+	const unsigned long epoch = atomic_fetch_add(&reg->epoch, 1) + 1;
+
+	// readers still announcing an older epoch may walk the old table
+	reg->retired[reg->nretired].methods = old;
+	reg->retired[reg->nretired].epoch = epoch;
+	reg->nretired++;
+
+	osc_registry_collect(reg);
+}
+
+static inline int
+osc_registry_init(osc_registry_t *reg, const osc_method_t *methods)
+{
+	osc_method_t *table = _osc_registry_alloc(methods,
+		_osc_registry_count(methods), 0);
+	if(!table)
+		return 0;
+
+	atomic_init(&reg->methods, table);
+	atomic_init(&reg->epoch, 1);
+	atomic_init(&reg->nreaders, 0);
+	reg->nretired = 0;
+
+	unsigned i;
+	for(i=0; i<OSC_REGISTRY_READERS; i++)
+		atomic_init(&reg->readers[i].epoch, 0);
+
+	return 1;
+}
+
+// no dispatch may be in progress anymore
+static inline void
+osc_registry_deinit(osc_registry_t *reg)
+{
+	unsigned i;
+	for(i=0; i<reg->nretired; i++)
+		free(reg->retired[i].methods);
+	reg->nretired = 0;
+
+	free(atomic_exchange(&reg->methods, NULL));
+}
+
+// get reader slot for a dispatch thread, -1 if all are taken
+static inline int
+osc_registry_reader(osc_registry_t *reg)
+{
+	const unsigned reader = atomic_fetch_add(&reg->nreaders, 1);
+	if(reader >= OSC_REGISTRY_READERS)
+	{
+		atomic_fetch_sub(&reg->nreaders, 1);
+		return -1;
+	}
+
+	return reader;
+}
+
+// replace whole method table
+static inline int
+osc_registry_set(osc_registry_t *reg, const osc_method_t *methods)
+{
+	osc_method_t *table = _osc_registry_alloc(methods,
+		_osc_registry_count(methods), 0);
+	if(!table)
+		return 0;
+
+	_osc_registry_publish(reg, table);
+
+	return 1;
+}
+
+// append method at the end of the table
+static inline int
+osc_registry_add(osc_registry_t *reg, const osc_method_t *method)
+{
+	const osc_method_t *cur = atomic_load_explicit(&reg->methods,
+		memory_order_relaxed);
+	const size_t n = _osc_registry_count(cur);
+
+	osc_method_t *table = _osc_registry_alloc(cur, n, 1);
+	if(!table)
+		return 0;
+	memcpy(&table[n], method, sizeof(osc_method_t));
+
+	_osc_registry_publish(reg, table);
+
+	return 1;
+}
+
+// remove all methods with given path and format, NULL matches NULL only
+static inline int
+osc_registry_remove(osc_registry_t *reg, const char *path, const char *fmt)
+{
+	const osc_method_t *cur = atomic_load_explicit(&reg->methods,
+		memory_order_relaxed);
+	const size_t n = _osc_registry_count(cur);
+
+	osc_method_t *table = _osc_registry_alloc(NULL, 0, n);
+	if(!table)
+		return 0;
+
+	size_t i;
+	size_t j = 0;
+	for(i=0; i<n; i++)
+	{
+		if(_osc_registry_streq(cur[i].path, path)
+				&& _osc_registry_streq(cur[i].fmt, fmt) )
+			continue;
+		memcpy(&table[j++], &cur[i], sizeof(osc_method_t));
+	}
+
+	_osc_registry_publish(reg, table);
+
+	return 1;
+}
+
+// like osc_dispatch_method on the currently published table
+static inline void
+osc_registry_dispatch(osc_registry_t *reg, int reader, const osc_data_t *buf,
+	size_t size, osc_bundle_in_cb_t bundle_in, osc_bundle_out_cb_t bundle_out,
+	void *data)
+{
+	atomic_ulong *announce = &reg->readers[reader].epoch;
+
+	// announce epoch before loading the table, see _osc_registry_publish
+	atomic_store_explicit(announce, atomic_load(&reg->epoch),
+		memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+
+	const osc_method_t *methods = atomic_load_explicit(&reg->methods,
+		memory_order_acquire);
+	osc_dispatch_method(buf, size, methods, bundle_in, bundle_out, data);
+
+	atomic_store_explicit(announce, 0, memory_order_release);
+}
+
+#endif /* _LIB_OSC_REGISTRY_H_ */
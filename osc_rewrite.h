@@ -0,0 +1,286 @@
+/*
+ * Copyright (c) 2015 Hanspeter Portner (dev@open-music-kontrollers.ch)
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the Artistic License 2.0 as published by
+ * The Perl Foundation.
+ *
+ * This source is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * Artistic License 2.0 for more details.
+ *
+ * You should have received a copy of the Artistic License 2.0
+ * along the source as a COPYING file. If not, obtain it from
+ * http://www.perlfoundation.org/artistic_license_2_0.
+ */
+
+#ifndef _LIB_OSC_REWRITE_H_
+#define _LIB_OSC_REWRITE_H_
+
+#include "osc.h"
+
+#if !defined(__WINDOWS__)
+#	include <sys/uio.h>
+#endif
+
+/*
+ * In-place address rewriting.
+ *
+ * Replaces the leading prefix from of message paths with to, whole path
+ * components only: /foo matches /foo and /foo/bar but not /foobar. Format
+ * and arguments never move. A path of the same or a shorter padded length
+ * is written in place, flush with the format string, so the message then
+ * starts later in the buffer. Inside bundles the item size is rewritten
+ * right in front of the moved message and enclosing bundle sizes are
+ * patched, the packet is returned as iovec list over the buffer. Longer
+ * paths and their item sizes go to a caller-provided scratch buffer and are
+ * spliced into the list, still without copying any argument data.
+ */
+
+typedef struct _osc_rewrite_t osc_rewrite_t;
+
+struct _osc_rewrite_t {
+	const char *from;
+	const char *to;
+	size_t fromlen;
+	size_t tolen;
+
+	struct iovec *iov;
+	unsigned max;
+	unsigned count;
+	size_t size; // total size of packet in iov
+
+	osc_data_t *scratch; // for growing paths
+	const osc_data_t *scratch_end;
+	osc_data_t *sptr;
+
+	uint32_t rewritten;
+};
+
+// length of rewritten path, 0 if path does not start with from
+static inline size_t
+_osc_rewrite_len(const char *from, size_t fromlen, size_t tolen, const char *path,
+	size_t pathlen)
+{
+	if( (pathlen < fromlen) || strncmp(path, from, fromlen) )
+		return 0;
+	if( (pathlen > fromlen) && (path[fromlen] != '/')
+			&& fromlen && (from[fromlen-1] != '/') )
+		return 0;
+
+	return tolen + pathlen - fromlen;
+}
+
+// write rewritten path into dst, which may overlap the old path
+static inline void
+_osc_rewrite_write(osc_data_t *dst, const char *to, size_t tolen,
+	const osc_data_t *suffix, size_t suflen, size_t padded)
+{
+	memmove(dst + tolen, suffix, suflen);
+	memcpy(dst, to, tolen);
+	memset(dst + tolen + suflen, '\0', padded - tolen - suflen);
+}
+
+// rewrite path of standalone message, returns new message start or NULL if
+// the path would grow, buf is returned unchanged when from does not match
+static inline osc_data_t *
+osc_rewrite_message(osc_data_t *buf, size_t size, const char *from, const char *to,
+	size_t *newsize)
+{
+	const size_t fromlen = strlen(from);
+	const size_t tolen = strlen(to);
+	const size_t pathlen = strnlen((const char *)buf, size);
+	const size_t len = _osc_rewrite_len(from, fromlen, tolen, (const char *)buf,
+		pathlen);
+
+	*newsize = size;
+	if(!len || (pathlen == size) )
+		return buf;
+
+	const size_t padded = OSC_PADDED_SIZE(pathlen + 1);
+	const size_t newpadded = OSC_PADDED_SIZE(len + 1);
+	if(newpadded > padded)
+		return NULL;
+
+	osc_data_t *dst = buf + (padded - newpadded);
+	_osc_rewrite_write(dst, to, tolen, buf + fromlen, pathlen - fromlen, newpadded);
+	*newsize = size - (padded - newpadded);
+
+	return dst;
+}
+
+static inline void
+osc_rewrite_init(osc_rewrite_t *rw, const char *from, const char *to,
+	struct iovec *iov, unsigned max, osc_data_t *scratch, size_t scratch_size)
+{
+	rw->from = from;
+	rw->to = to;
+	rw->fromlen = strlen(from);
+	rw->tolen = strlen(to);
+	rw->iov = iov;
+	rw->max = max;
+	rw->count = 0;
+	rw->size = 0;
+	rw->scratch = scratch;
+	rw->scratch_end = scratch + scratch_size;
+	rw->sptr = scratch;
+	rw->rewritten = 0;
+}
+
+// append to iovec list, merge with previous entry if contiguous
+static inline int
+_osc_rewrite_emit(osc_rewrite_t *rw, const osc_data_t *ptr, size_t len)
+{
+	rw->size += len;
+
+	if(rw->count)
+	{
+		struct iovec *last = &rw->iov[rw->count - 1];
+		if((const osc_data_t *)last->iov_base + last->iov_len == ptr)
+		{
+			last->iov_len += len;
+			return 1;
+		}
+	}
+
+	if(rw->count == rw->max)
+		return 0;
+
+	rw->iov[rw->count].iov_base = (void *)ptr;
+	rw->iov[rw->count].iov_len = len;
+	rw->count++;
+
+	return 1;
+}
+
+// message, with its item size field in front of it if item is set,
+// returns its new size or -1 on failure
+static inline int32_t
+_osc_rewrite_message(osc_rewrite_t *rw, osc_data_t *buf, size_t size, int item)
+{
+	osc_data_t *hdr = item ? buf - 4 : buf;
+	const size_t hdrlen = item ? 4 : 0;
+
+	const size_t pathlen = strnlen((const char *)buf, size);
+	if(pathlen == size)
+		return -1;
+
+	const size_t len = _osc_rewrite_len(rw->from, rw->fromlen, rw->tolen,
+		(const char *)buf, pathlen);
+	if(!len)
+		return _osc_rewrite_emit(rw, hdr, hdrlen + size) ? (int32_t)size : -1;
+
+	const size_t padded = OSC_PADDED_SIZE(pathlen + 1);
+	const size_t newpadded = OSC_PADDED_SIZE(len + 1);
+	const size_t newsize = size - padded + newpadded;
+	rw->rewritten++;
+
+	if(newpadded <= padded) // in place, flush with format
+	{
+		osc_data_t *dst = buf + (padded - newpadded);
+		_osc_rewrite_write(dst, rw->to, rw->tolen, buf + rw->fromlen,
+			pathlen - rw->fromlen, newpadded);
+		if(item)
+			osc_set_int32(dst - 4, dst, newsize);
+
+		return _osc_rewrite_emit(rw, dst - hdrlen, hdrlen + newsize)
+			? (int32_t)newsize : -1;
+	}
+
+	// splice new item size and path from scratch in front of format
+	osc_data_t *dst = rw->sptr;
+	if(dst + hdrlen + newpadded > rw->scratch_end)
+		return -1;
+	rw->sptr += hdrlen + newpadded;
+
+	if(item)
+		osc_set_int32(dst, rw->sptr, newsize);
+	memcpy(dst + hdrlen, rw->to, rw->tolen);
+	memcpy(dst + hdrlen + rw->tolen, buf + rw->fromlen, pathlen - rw->fromlen);
+	memset(dst + hdrlen + len, '\0', newpadded - len);
+
+	if( !_osc_rewrite_emit(rw, dst, hdrlen + newpadded)
+			|| !_osc_rewrite_emit(rw, buf + padded, size - padded) )
+		return -1;
+
+	return newsize;
+}
+
+static inline int32_t
+_osc_rewrite_bundle(osc_rewrite_t *rw, osc_data_t *buf, size_t size)
+{
+	if( (size < 16) || strncmp((const char *)buf, "#bundle", 8) )
+		return -1;
+
+	if(!_osc_rewrite_emit(rw, buf, 16))
+		return -1;
+
+	const osc_data_t *end = buf + size;
+	osc_data_t *ptr = buf + 16;
+	int32_t newsize = 16;
+
+	while(ptr < end)
+	{
+		if(ptr + 4 > end)
+			return -1;
+
+		osc_data_t *hdr = ptr;
+		const int32_t len = be32toh(*((const int32_t *)hdr));
+		ptr += 4;
+		if( (len <= 0) || (ptr + len > end) )
+			return -1;
+
+		int32_t itemsize;
+		switch(*ptr)
+		{
+			case '#':
+				// size field stays in place, patch it after the children
+				if(!_osc_rewrite_emit(rw, hdr, 4))
+					return -1;
+				itemsize = _osc_rewrite_bundle(rw, ptr, len);
+				if(itemsize >= 0)
+					osc_set_int32(hdr, ptr, itemsize);
+				break;
+			case '/':
+				itemsize = _osc_rewrite_message(rw, ptr, len, 1);
+				break;
+			default:
+				return -1;
+		}
+
+		if(itemsize < 0)
+			return -1;
+
+		newsize += 4 + itemsize;
+		ptr += len;
+	}
+
+	return newsize;
+}
+
+// rewrite message or bundle into iovec list, returns 0 on malformed packet,
+// full iovec list or full scratch buffer, buf is modified in any case
+static inline int
+osc_rewrite_packet(osc_rewrite_t *rw, osc_data_t *buf, size_t size)
+{
+	rw->count = 0;
+	rw->size = 0;
+	rw->sptr = rw->scratch;
+	rw->rewritten = 0;
+
+	if(!size)
+		return 0;
+
+	switch(*buf)
+	{
+		case '#':
+			return _osc_rewrite_bundle(rw, buf, size) >= 0;
+		case '/':
+			return _osc_rewrite_message(rw, buf, size, 0) >= 0;
+	}
+
+	return 0;
+}
+
+#endif /* _LIB_OSC_REWRITE_H_ */
@@ -0,0 +1,362 @@
+/*
+ * Copyright (c) 2015 Hanspeter Portner (dev@open-music-kontrollers.ch)
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the Artistic License 2.0 as published by
+ * The Perl Foundation.
+ *
+ * This source is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * Artistic License 2.0 for more details.
+ *
+ * You should have received a copy of the Artistic License 2.0
+ * along the source as a COPYING file. If not, obtain it from
+ * http://www.perlfoundation.org/artistic_license_2_0.
+ */
+
+#ifndef _LIB_OSC_RT_H_
+#define _LIB_OSC_RT_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__cplusplus)
+#	include <atomic>
+#else
+#	include <stdatomic.h>
+#endif
+
+/*
+ * Realtime safety.
+ *
+ * The following never allocate, lock or make system calls, given callbacks
+ * which do not either, and may be used from audio threads:
+ *
+ * osc.h: osc_check_*, osc_get_*, osc_set_*, osc_fmt_*, osc_hash,
+ *   osc_dispatch_method, osc_unroll_packet, bundle and array helpers
+ * osc_fmt.h, osc_schema.h, osc_columns.h, osc_swap.h: everything
+ * osc_merge.h, osc_coalesce.h, osc_intern.h, osc_cache.h: everything
+ * osc_registry.h: osc_registry_dispatch, never the writer side
+ * osc_batch.h, osc_rewrite.h, osc_chunk.h: everything, sending is up to
+ *   the callback
+ * osc_check.h: osc_check_batch, osc_unroll.h: osc_unroll_index and
+ *   osc_unroll_dispatch with OSC_UNROLL_ORDER_TOTAL
+ * osc.hpp: argument, message_view, bundle_view, packet_builder as long as
+ *   packets fit packet_buffer::inline_size
+ *
+ * Not realtime safe: osc_pool.h and everything running on it,
+ * osc_publish.h (sends), osc_coro.hpp (first use of a pattern allocates).
+ *
+ * To audit, define OSC_RT_AUDIT_HOOKS in exactly one C translation unit of
+ * a test program before including this header. This interposes malloc and
+ * friends (glibc only) and a set of blocking libc calls, each call made by
+ * a thread between osc_rt_enter and osc_rt_leave counts as a violation.
+ * C++ code of the same program may include this header as well and is
+ * audited alike. sendmmsg is only hooked with _GNU_SOURCE defined.
+ * osc_rt_hist_t collects per-operation execution times for worst-case
+ * reports, CLOCK_MONOTONIC is read through the vDSO without a system call.
+ * test/osc_rt_test.c runs such an audit, test/osc_rt_bench.c reports
+ * execution times.
+ */
+
+typedef enum _osc_rt_violation_t {
+	OSC_RT_ALLOC,
+	OSC_RT_LOCK,
+	OSC_RT_SYSCALL,
+
+	OSC_RT_MAX
+} osc_rt_violation_t;
+
+typedef struct _osc_rt_hist_t osc_rt_hist_t;
+
+#define OSC_RT_HIST_SUB 16 // linear sub-buckets per power of two
+#define OSC_RT_HIST_BUCKETS (64 * OSC_RT_HIST_SUB)
+
+struct _osc_rt_hist_t {
+	uint64_t count;
+	uint64_t max; // exact, in nanoseconds
+	uint64_t bins [OSC_RT_HIST_BUCKETS];
+};
+
+#if defined(__cplusplus)
+extern "C" {
+extern thread_local int _osc_rt_depth;
+extern std::atomic_ulong _osc_rt_violations [OSC_RT_MAX];
+}
+#else
+extern _Thread_local int _osc_rt_depth;
+extern atomic_ulong _osc_rt_violations [OSC_RT_MAX];
+#endif
+
+static inline void
+osc_rt_enter(void)
+{
+	_osc_rt_depth++;
+}
+
+static inline void
+osc_rt_leave(void)
+{
+	_osc_rt_depth--;
+}
+
+static inline unsigned long
+osc_rt_violations(osc_rt_violation_t type)
+{
+	return atomic_load(&_osc_rt_violations[type]); // std:: found by ADL in C++
+}
+
+static inline uint64_t
+osc_rt_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline void
+osc_rt_hist_init(osc_rt_hist_t *hist)
+{
+	memset(hist, 0, sizeof(osc_rt_hist_t));
+}
+
+// bucket of value, exact below OSC_RT_HIST_SUB, else within 1/OSC_RT_HIST_SUB
+static inline unsigned
+_osc_rt_hist_bucket(uint64_t ns)
+{
+	if(ns < OSC_RT_HIST_SUB)
+		return (unsigned)ns;
+
+	const unsigned msb = 63 - __builtin_clzll(ns);
+	const unsigned shift = msb - 4; // log2(OSC_RT_HIST_SUB)
+	return (shift + 1) * OSC_RT_HIST_SUB + ((ns >> shift) - OSC_RT_HIST_SUB);
+}
+
+// lower bound of bucket
+static inline uint64_t
+_osc_rt_hist_value(unsigned bucket)
+{
+	if(bucket < OSC_RT_HIST_SUB)
+		return bucket;
+
+	const unsigned shift = bucket / OSC_RT_HIST_SUB - 1;
+	return (uint64_t)(bucket % OSC_RT_HIST_SUB + OSC_RT_HIST_SUB) << shift;
+}
+
+static inline void
+osc_rt_hist_add(osc_rt_hist_t *hist, uint64_t ns)
+{
+	hist->bins[_osc_rt_hist_bucket(ns)]++;
+	hist->count++;
+	if(ns > hist->max)
+		hist->max = ns;
+}
+
+// q in [0, 1], e.g. 0.999
+static inline uint64_t
+osc_rt_hist_quantile(const osc_rt_hist_t *hist, double q)
+{
+	const uint64_t rank = q * hist->count;
+	uint64_t seen = 0;
+
+	unsigned i;
+	for(i=0; i<OSC_RT_HIST_BUCKETS; i++)
+	{
+		seen += hist->bins[i];
+		if(seen > rank)
+			return _osc_rt_hist_value(i);
+	}
+
+	return hist->max;
+}
+
+static inline void
+osc_rt_hist_print(FILE *f, const char *name, const osc_rt_hist_t *hist)
+{
+	fprintf(f, "%-24s n=%-10llu p50=%-8llu p99=%-8llu p99.9=%-8llu max=%llu ns\n",
+		name, (unsigned long long)hist->count,
+		(unsigned long long)osc_rt_hist_quantile(hist, 0.5),
+		(unsigned long long)osc_rt_hist_quantile(hist, 0.99),
+		(unsigned long long)osc_rt_hist_quantile(hist, 0.999),
+		(unsigned long long)hist->max);
+}
+
+// time one execution of stmt into hist, within an audited section
+#define OSC_RT_MEASURE(hist, stmt) \
+	do { \
+		osc_rt_enter(); \
+		const uint64_t _osc_rt_t0 = osc_rt_now(); \
+		stmt; \
+		osc_rt_hist_add((hist), osc_rt_now() - _osc_rt_t0); \
+		osc_rt_leave(); \
+	} while(0)
+
+#if defined(OSC_RT_AUDIT_HOOKS)
+
+#if defined(__cplusplus)
+#	error "define OSC_RT_AUDIT_HOOKS in a C translation unit"
+#endif
+
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+_Thread_local int _osc_rt_depth = 0;
+atomic_ulong _osc_rt_violations [OSC_RT_MAX];
+
+static inline void
+_osc_rt_violation(osc_rt_violation_t type)
+{
+	if(_osc_rt_depth > 0)
+		atomic_fetch_add_explicit(&_osc_rt_violations[type], 1, memory_order_relaxed);
+}
+
+// glibc entry points, avoid dlsym recursion for the allocator
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+void *
+malloc(size_t size)
+{
+	_osc_rt_violation(OSC_RT_ALLOC);
+	return __libc_malloc(size);
+}
+
+void *
+calloc(size_t n, size_t size)
+{
+	_osc_rt_violation(OSC_RT_ALLOC);
+	return __libc_calloc(n, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+	_osc_rt_violation(OSC_RT_ALLOC);
+	return __libc_realloc(ptr, size);
+}
+
+void
+free(void *ptr)
+{
+	if(ptr)
+		_osc_rt_violation(OSC_RT_ALLOC);
+	__libc_free(ptr);
+}
+
+#define _OSC_RT_NEXT(name) \
+	static __typeof__(name) *next; \
+	if(!next) \
+		next = (__typeof__(name) *)dlsym(RTLD_NEXT, #name)
+
+int
+pthread_mutex_lock(pthread_mutex_t *mutex)
+{
+	_OSC_RT_NEXT(pthread_mutex_lock);
+	_osc_rt_violation(OSC_RT_LOCK);
+	return next(mutex);
+}
+
+int
+sched_yield(void)
+{
+	_OSC_RT_NEXT(sched_yield);
+	_osc_rt_violation(OSC_RT_SYSCALL);
+	return next();
+}
+
+ssize_t
+write(int fd, const void *buf, size_t count)
+{
+	_OSC_RT_NEXT(write);
+	_osc_rt_violation(OSC_RT_SYSCALL);
+	return next(fd, buf, count);
+}
+
+ssize_t
+read(int fd, void *buf, size_t count)
+{
+	_OSC_RT_NEXT(read);
+	_osc_rt_violation(OSC_RT_SYSCALL);
+	return next(fd, buf, count);
+}
+
+ssize_t
+send(int fd, const void *buf, size_t len, int flags)
+{
+	_OSC_RT_NEXT(send);
+	_osc_rt_violation(OSC_RT_SYSCALL);
+	return next(fd, buf, len, flags);
+}
+
+ssize_t
+sendto(int fd, const void *buf, size_t len, int flags,
+	const struct sockaddr *addr, socklen_t addrlen)
+{
+	_OSC_RT_NEXT(sendto);
+	_osc_rt_violation(OSC_RT_SYSCALL);
+	return next(fd, buf, len, flags, addr, addrlen);
+}
+
+ssize_t
+sendmsg(int fd, const struct msghdr *msg, int flags)
+{
+	_OSC_RT_NEXT(sendmsg);
+	_osc_rt_violation(OSC_RT_SYSCALL);
+	return next(fd, msg, flags);
+}
+
+#if defined(_GNU_SOURCE)
+int
+sendmmsg(int fd, struct mmsghdr *msgs, unsigned int vlen, int flags)
+{
+	_OSC_RT_NEXT(sendmmsg);
+	_osc_rt_violation(OSC_RT_SYSCALL);
+	return next(fd, msgs, vlen, flags);
+}
+#endif
+
+ssize_t
+recv(int fd, void *buf, size_t len, int flags)
+{
+	_OSC_RT_NEXT(recv);
+	_osc_rt_violation(OSC_RT_SYSCALL);
+	return next(fd, buf, len, flags);
+}
+
+ssize_t
+recvfrom(int fd, void *buf, size_t len, int flags, struct sockaddr *addr,
+	socklen_t *addrlen)
+{
+	_OSC_RT_NEXT(recvfrom);
+	_osc_rt_violation(OSC_RT_SYSCALL);
+	return next(fd, buf, len, flags, addr, addrlen);
+}
+
+ssize_t
+recvmsg(int fd, struct msghdr *msg, int flags)
+{
+	_OSC_RT_NEXT(recvmsg);
+	_osc_rt_violation(OSC_RT_SYSCALL);
+	return next(fd, msg, flags);
+}
+
+int
+nanosleep(const struct timespec *req, struct timespec *rem)
+{
+	_OSC_RT_NEXT(nanosleep);
+	_osc_rt_violation(OSC_RT_SYSCALL);
+	return next(req, rem);
+}
+
+#undef _OSC_RT_NEXT
+
+#endif // OSC_RT_AUDIT_HOOKS
+
+#endif /* _LIB_OSC_RT_H_ */
@@ -0,0 +1,240 @@
+/*
+ * Copyright (c) 2015 Hanspeter Portner (dev@open-music-kontrollers.ch)
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the Artistic License 2.0 as published by
+ * The Perl Foundation.
+ *
+ * This source is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * Artistic License 2.0 for more details.
+ *
+ * You should have received a copy of the Artistic License 2.0
+ * along the source as a COPYING file. If not, obtain it from
+ * http://www.perlfoundation.org/artistic_license_2_0.
+ */
+
+#ifndef _LIB_OSC_SCHEMA_H_
+#define _LIB_OSC_SCHEMA_H_
+
+#include "osc.h"
+
+/*
+ * Schema registry.
+ *
+ * Declares the allowed type signatures per address, an address may appear
+ * with several signatures. For all-fixed-size signatures the total message
+ * size and every argument offset are precomputed, so validation is one
+ * size compare plus one format compare and handlers can read arguments
+ * with the unchecked getters below. Messages to a declared address which
+ * match none of its signatures count as rejected.
+ */
+
+#ifndef OSC_SCHEMA_MAX_ARGS
+#	define OSC_SCHEMA_MAX_ARGS 16
+#endif
+
+#define OSC_SCHEMA_LANE(n) ((n) + 1) // lane field value for ingest lane n
+
+typedef struct _osc_schema_t osc_schema_t;
+typedef struct _osc_schema_registry_t osc_schema_registry_t;
+
+struct _osc_schema_t {
+	const char *path;
+	const char *fmt; // without leading ','
+	unsigned lane; // OSC_SCHEMA_LANE of osc_lanes.h ingest lane, 0 for none
+
+	// filled by osc_schema_registry_init
+	uint32_t hash;
+	uint32_t fmtlen; // unpadded
+	uint32_t size; // total message size for all-fixed signatures, else 0
+	uint32_t nfixed; // number of leading fixed-size arguments
+	uint32_t offset [OSC_SCHEMA_MAX_ARGS]; // from message start
+};
+
+struct _osc_schema_registry_t {
+	osc_schema_t *schemas; // terminated by an entry with NULL path
+
+	uint32_t accepted;
+	uint32_t rejected;
+	uint32_t unknown; // no schema declared for address
+};
+
+static inline int
+osc_schema_registry_init(osc_schema_registry_t *reg, osc_schema_t *schemas)
+{
+	osc_schema_t *s;
+	for(s=schemas; s->path; s++)
+	{
+		if(!osc_check_fmt(s->fmt, 0))
+			return 0;
+
+		s->hash = osc_hash(s->path, strlen(s->path));
+		s->fmtlen = strlen(s->fmt);
+		s->nfixed = 0;
+
+		size_t off = osc_strlen(s->path) + osc_fmtlen(s->fmt) + 1;
+		int all_fixed = 1;
+
+		const char *type;
+		for(type=s->fmt; *type; type++)
+		{
+			const int size = osc_type_size((osc_type_t)*type);
+			if(size < 0)
+			{
+				all_fixed = 0;
+				break;
+			}
+			if(s->nfixed < OSC_SCHEMA_MAX_ARGS)
+				s->offset[s->nfixed++] = off;
+			off += size;
+		}
+
+		s->size = all_fixed ? off : 0;
+	}
+
+	reg->schemas = schemas;
+	reg->accepted = 0;
+	reg->rejected = 0;
+	reg->unknown = 0;
+
+	return 1;
+}
+
+// walk arguments of a variable-size signature within bounds
+static inline int
+_osc_schema_check_args(const char *fmt, const osc_data_t *ptr,
+	const osc_data_t *end)
+{
+	const char *type;
+	for(type=fmt; *type && (ptr <= end); type++)
+	{
+		const int size = osc_type_size((osc_type_t)*type);
+		if(size >= 0)
+			ptr += size;
+		else if(*type == OSC_BLOB)
+			ptr = (ptr + 4 <= end) ? ptr + osc_bloblen(ptr) : end + 1;
+		else // OSC_STRING, OSC_SYMBOL
+			ptr += OSC_PADDED_SIZE(strnlen((const char *)ptr, end - ptr) + 1);
+	}
+
+	return ptr == end;
+}
+
+// first schema from s on declared for path with osc_hash hash, NULL if none
+static inline const osc_schema_t *
+osc_schema_lookup(const osc_schema_t *s, const char *path, uint32_t hash)
+{
+	for( ; s->path; s++)
+		if( (s->hash == hash) && !strcmp(s->path, path) )
+			return s;
+
+	return NULL;
+}
+
+// get schema the message conforms to, NULL if there is none
+static inline const osc_schema_t *
+osc_schema_validate(osc_schema_registry_t *reg, const osc_data_t *buf,
+	size_t size)
+{
+	const char *path = (const char *)buf;
+	const size_t len = strnlen(path, size);
+	if(len == size)
+	{
+		reg->rejected++;
+		return NULL;
+	}
+
+	const uint32_t hash = osc_hash(path, len);
+	const osc_data_t *fmt = buf + OSC_PADDED_SIZE(len + 1);
+	int known = 0;
+
+	const osc_schema_t *s;
+	for(s=osc_schema_lookup(reg->schemas, path, hash); s;
+		s=osc_schema_lookup(s + 1, path, hash))
+	{
+		known = 1;
+
+		if(s->size) // all-fixed: one size and one format compare
+		{
+			if( (size == s->size) && (fmt[0] == ',')
+					&& !memcmp(fmt + 1, s->fmt, s->fmtlen + 1) )
+			{
+				reg->accepted++;
+				return s;
+			}
+		}
+		else if( (fmt + OSC_PADDED_SIZE(s->fmtlen + 2) <= buf + size)
+				&& (fmt[0] == ',') && !memcmp(fmt + 1, s->fmt, s->fmtlen + 1)
+				&& _osc_schema_check_args(s->fmt, fmt + OSC_PADDED_SIZE(s->fmtlen + 2),
+					buf + size) )
+		{
+			reg->accepted++;
+			return s;
+		}
+	}
+
+	if(known)
+		reg->rejected++;
+	else
+		reg->unknown++;
+
+	return NULL;
+}
+
+// unchecked getters for the i-th argument of a validated message,
+// i must be smaller than nfixed of its schema
+static inline int32_t
+osc_schema_int32(const osc_schema_t *s, const osc_data_t *buf, unsigned i)
+{
+	swap32_t u = {.u = *(const uint32_t *)(buf + s->offset[i])};
+	u.u = be32toh(u.u);
+	return u.i;
+}
+
+static inline float
+osc_schema_float(const osc_schema_t *s, const osc_data_t *buf, unsigned i)
+{
+	swap32_t u = {.u = *(const uint32_t *)(buf + s->offset[i])};
+	u.u = be32toh(u.u);
+	return u.f;
+}
+
+static inline int64_t
+osc_schema_int64(const osc_schema_t *s, const osc_data_t *buf, unsigned i)
+{
+	swap64_t u = {.u = *(const uint64_t *)(buf + s->offset[i])};
+	u.u = be64toh(u.u);
+	return u.h;
+}
+
+static inline double
+osc_schema_double(const osc_schema_t *s, const osc_data_t *buf, unsigned i)
+{
+	swap64_t u = {.u = *(const uint64_t *)(buf + s->offset[i])};
+	u.u = be64toh(u.u);
+	return u.d;
+}
+
+static inline osc_time_t
+osc_schema_timetag(const osc_schema_t *s, const osc_data_t *buf, unsigned i)
+{
+	swap64_t u = {.u = *(const uint64_t *)(buf + s->offset[i])};
+	u.u = be64toh(u.u);
+	return u.t;
+}
+
+static inline char
+osc_schema_char(const osc_schema_t *s, const osc_data_t *buf, unsigned i)
+{
+	return osc_schema_int32(s, buf, i) & 0xff;
+}
+
+static inline const uint8_t *
+osc_schema_midi(const osc_schema_t *s, const osc_data_t *buf, unsigned i)
+{
+	return buf + s->offset[i];
+}
+
+#endif /* _LIB_OSC_SCHEMA_H_ */
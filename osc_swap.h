@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2015 Hanspeter Portner (dev@open-music-kontrollers.ch)
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the Artistic License 2.0 as published by
+ * The Perl Foundation.
+ *
+ * This source is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * Artistic License 2.0 for more details.
+ *
+ * You should have received a copy of the Artistic License 2.0
+ * along the source as a COPYING file. If not, obtain it from
+ * http://www.perlfoundation.org/artistic_license_2_0.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include "osc_platform.h"
+
+/*
+ * Bulk conversion of 32/64-bit words between host and network byte order.
+ * Conversion is symmetric, dst and src may be unaligned and may be equal,
+ * but must not overlap otherwise. Kernels are picked at compile time.
+ */
+
+#if defined(__AVX2__)
+#	include <immintrin.h>
+#elif defined(__SSSE3__)
+#	include <tmmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#	include <arm_neon.h>
+#endif
+
+static inline void
+osc_swap32_n(void *dst, const void *src, size_t n)
+{
+	uint8_t *d = (uint8_t *)dst;
+	const uint8_t *s = (const uint8_t *)src;
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+	if(d != s)
+		memcpy(d, s, n*4);
+#else
+	size_t i = 0;
+
+#if defined(__AVX2__)
+	const __m256i mask8 = _mm256_setr_epi8(
+		3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+		3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+	for( ; i + 8 <= n; i += 8)
+	{
+		const __m256i v = _mm256_loadu_si256((const __m256i *)(s + i*4));
+		_mm256_storeu_si256((__m256i *)(d + i*4), _mm256_shuffle_epi8(v, mask8));
+	}
+#endif
+
+#if defined(__SSSE3__)
+	const __m128i mask4 = _mm_setr_epi8(
+		3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+	for( ; i + 4 <= n; i += 4)
+	{
+		const __m128i v = _mm_loadu_si128((const __m128i *)(s + i*4));
+		_mm_storeu_si128((__m128i *)(d + i*4), _mm_shuffle_epi8(v, mask4));
+	}
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	for( ; i + 4 <= n; i += 4)
+		vst1q_u8(d + i*4, vrev32q_u8(vld1q_u8(s + i*4)));
+#endif
+
+	for( ; i < n; i++)
+	{
+		uint32_t u;
+		memcpy(&u, s + i*4, 4);
+		u = be32toh(u);
+		memcpy(d + i*4, &u, 4);
+	}
+#endif
+}
+
+static inline void
+osc_swap64_n(void *dst, const void *src, size_t n)
+{
+	uint8_t *d = (uint8_t *)dst;
+	const uint8_t *s = (const uint8_t *)src;
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+	if(d != s)
+		memcpy(d, s, n*8);
+#else
+	size_t i = 0;
+
+#if defined(__AVX2__)
+	const __m256i mask4 = _mm256_setr_epi8(
+		7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+		7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+	for( ; i + 4 <= n; i += 4)
+	{
+		const __m256i v = _mm256_loadu_si256((const __m256i *)(s + i*8));
+		_mm256_storeu_si256((__m256i *)(d + i*8), _mm256_shuffle_epi8(v, mask4));
+	}
+#endif
+
+#if defined(__SSSE3__)
+	const __m128i mask2 = _mm_setr_epi8(
+		7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+	for( ; i + 2 <= n; i += 2)
+	{
+		const __m128i v = _mm_loadu_si128((const __m128i *)(s + i*8));
+		_mm_storeu_si128((__m128i *)(d + i*8), _mm_shuffle_epi8(v, mask2));
+	}
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	for( ; i + 2 <= n; i += 2)
+		vst1q_u8(d + i*8, vrev64q_u8(vld1q_u8(s + i*8)));
+#endif
+
+	for( ; i < n; i++)
+	{
+		uint64_t u;
+		memcpy(&u, s + i*8, 8);
+		u = be64toh(u);
+		memcpy(d + i*8, &u, 8);
+	}
+#endif
+}
@@ -0,0 +1,845 @@
+/*
+ * Copyright (c) 2015 Hanspeter Portner (dev@open-music-kontrollers.ch)
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the Artistic License 2.0 as published by
+ * The Perl Foundation.
+ *
+ * This source is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * Artistic License 2.0 for more details.
+ *
+ * You should have received a copy of the Artistic License 2.0
+ * along the source as a COPYING file. If not, obtain it from
+ * http://www.perlfoundation.org/artistic_license_2_0.
+ */
+
+#ifndef _LIB_OSC_TEXT_HPP_
+#define _LIB_OSC_TEXT_HPP_
+
+#include "osc.hpp"
+
+#include <charconv>
+
+namespace osc {
+
+/*
+ * Text codec, C++20.
+ *
+ * One packet per line, arguments follow the format string:
+ *
+ *   /foo ,ifs[hd]T 1 2.5 "x" [ -7 0.1 ]
+ *   #bundle 0x0000000000000001 { /a ,i 1 #bundle 0xe9a1c0de00000000 { } }
+ *
+ * Integers are decimal, floats and doubles the shortest text that reads
+ * back to the same value, through the locale-independent std::to_chars and
+ * std::from_chars. Strings, symbols and chars are quoted with C escapes,
+ * bytes above 0x7f pass unchanged. Timetags, MIDI and RGBA are fixed-width
+ * hex, blobs two hex digits per byte, all with a 0x prefix. Flags have no
+ * value, array brackets are tokens of their own.
+ *
+ * Text is at most text_bound times the packet size, so to_text writes into
+ * a buffer sized up front without further checks. text_writer collects
+ * lines in caller storage and hands them to a sink only when the next one
+ * might not fit, i.e. one write per storage size for logging.
+ */
+
+namespace detail {
+
+inline void
+store32(std::byte *ptr, uint32_t v) noexcept
+{
+	ptr[0] = std::byte(v >> 24);
+	ptr[1] = std::byte(v >> 16);
+	ptr[2] = std::byte(v >> 8);
+	ptr[3] = std::byte(v);
+}
+
+// printed unescaped within quotes
+constexpr bool
+text_plain(uint8_t c, char quote) noexcept
+{
+	return (c >= 0x20) && (c != 0x7f) && (c != '\\') && (c != uint8_t(quote));
+}
+
+inline char *
+text_hex(char *out, uint64_t v, unsigned digits) noexcept
+{
+	*out++ = '0';
+	*out++ = 'x';
+	for(unsigned i = 0; i < digits; i++)
+		out[digits - 1 - i] = hex_digits[(v >> (4*i)) & 0xf];
+	return out + digits;
+}
+
+inline char *
+text_escape(char *out, uint8_t c) noexcept
+{
+	*out++ = '\\';
+	switch(c)
+	{
+		case '\n':
+			*out++ = 'n';
+			break;
+		case '\t':
+			*out++ = 't';
+			break;
+		case '\r':
+			*out++ = 'r';
+			break;
+		case '\\': case '"': case '\'':
+			*out++ = char(c);
+			break;
+		default:
+			*out++ = 'x';
+			*out++ = hex_digits[c >> 4];
+			*out++ = hex_digits[c & 0xf];
+			break;
+	}
+	return out;
+}
+
+inline char *
+text_quoted(char *out, const char *str, size_t len, char quote) noexcept
+{
+	*out++ = quote;
+
+	size_t run = 0; // start of pending unescaped run
+	for(size_t i = 0; i < len; i++)
+	{
+		const uint8_t c = uint8_t(str[i]);
+		if(text_plain(c, quote))
+			continue;
+
+		std::memcpy(out, str + run, i - run);
+		out = text_escape(out + (i - run), c);
+		run = i + 1;
+	}
+	std::memcpy(out, str + run, len - run);
+	out += len - run;
+
+	*out++ = quote;
+	return out;
+}
+
+inline char *
+text_message(char *out, const message_view &msg) noexcept
+{
+	if(!msg.header_valid())
+		return nullptr;
+
+	const std::string_view path = msg.path();
+	const std::string_view format = msg.format();
+	const std::span<const std::byte> buf = msg.data();
+
+	std::memcpy(out, path.data(), path.size());
+	out += path.size();
+	*out++ = ' ';
+	*out++ = ',';
+	std::memcpy(out, format.data(), format.size());
+	out += format.size();
+
+	size_t off = padded(path.size() + 1) + padded(format.size() + 2);
+	for(const char type : format)
+	{
+		const size_t size = (off <= buf.size())
+			? arg_size(type, buf.subspan(off)) : npos;
+		if(size == npos)
+			return nullptr;
+
+		const std::byte *ptr = buf.data() + off;
+		off += size;
+
+		switch(type)
+		{
+			case OSC_TRUE: case OSC_FALSE: case OSC_NIL: case OSC_BANG:
+				continue;
+			default:
+				break;
+		}
+
+		*out++ = ' ';
+		switch(type)
+		{
+			case OSC_INT32:
+				out = std::to_chars(out, out + 11, int32_t(load32(ptr))).ptr;
+				break;
+			case OSC_INT64:
+				out = std::to_chars(out, out + 20, int64_t(load64(ptr))).ptr;
+				break;
+			case OSC_FLOAT:
+				out = std::to_chars(out, out + 15, std::bit_cast<float>(load32(ptr))).ptr;
+				break;
+			case OSC_DOUBLE:
+				out = std::to_chars(out, out + 24, std::bit_cast<double>(load64(ptr))).ptr;
+				break;
+			case OSC_TIMETAG:
+				out = text_hex(out, load64(ptr), 16);
+				break;
+			case OSC_MIDI: case OSC_RGBA:
+				out = text_hex(out, load32(ptr), 8);
+				break;
+			case OSC_CHAR:
+			{
+				const char c = char(load32(ptr));
+				out = text_quoted(out, &c, 1, '\'');
+				break;
+			}
+			case OSC_STRING: case OSC_SYMBOL:
+				out = text_quoted(out, reinterpret_cast<const char *>(ptr),
+					std::strlen(reinterpret_cast<const char *>(ptr)), '"');
+				break;
+			case OSC_BLOB:
+			{
+				const uint32_t len = load32(ptr);
+				*out++ = '0';
+				*out++ = 'x';
+				for(uint32_t i = 0; i < len; i++)
+				{
+					const uint8_t c = uint8_t(ptr[4 + i]);
+					*out++ = hex_digits[c >> 4];
+					*out++ = hex_digits[c & 0xf];
+				}
+				break;
+			}
+			case OSC_AOPEN: case OSC_ACLOSE:
+				*out++ = type;
+				break;
+			default:
+				return nullptr;
+		}
+	}
+
+	return (off == buf.size()) ? out : nullptr;
+}
+
+inline char *
+text_bundle(char *out, const bundle_view &bndl) noexcept
+{
+	if(!bndl.valid())
+		return nullptr;
+
+	std::memcpy(out, "#bundle ", 8);
+	out = text_hex(out + 8, bndl.time(), 16);
+	*out++ = ' ';
+	*out++ = '{';
+
+	// walk items by hand, bundle_view stops silently at malformed ones
+	std::span<const std::byte> rest = bndl.data().subspan(16);
+	while(!rest.empty())
+	{
+		if(rest.size() < 4)
+			return nullptr;
+		const int32_t len = int32_t(load32(rest.data()));
+		if( (len <= 0) || (size_t(len) > rest.size() - 4) )
+			return nullptr;
+
+		const auto item = rest.subspan(4, len);
+		*out++ = ' ';
+		if(item[0] == std::byte{'/'})
+			out = text_message(out, message_view(item));
+		else if(item[0] == std::byte{'#'})
+			out = text_bundle(out, bundle_view(item));
+		else
+			return nullptr;
+		if(!out)
+			return nullptr;
+
+		rest = rest.subspan(4 + len);
+	}
+
+	*out++ = ' ';
+	*out++ = '}';
+	return out;
+}
+
+class text_parser
+{
+public:
+	text_parser(std::string_view text, std::span<std::byte> out) noexcept
+		: cur_(text.data()), last_(text.data() + text.size()),
+		base_(out.data()), out_(out.data()), end_(out.data() + out.size())
+	{}
+
+	// parse one packet, returns its size or 0
+	size_t
+	packet() noexcept
+	{
+		skip();
+		if( (cur_ == last_) || !element() )
+			return 0;
+		return out_ - base_;
+	}
+
+	// text consumed so far
+	const char *
+	pos() const noexcept
+	{
+		return cur_;
+	}
+
+	// failed for lack of output space only
+	bool
+	overflow() const noexcept
+	{
+		return overflow_;
+	}
+
+private:
+	static constexpr bool
+	space(char c) noexcept
+	{
+		return (c == ' ') || (c == '\t') || (c == '\n') || (c == '\r');
+	}
+
+	void
+	skip() noexcept
+	{
+		while( (cur_ < last_) && space(*cur_) )
+			cur_++;
+	}
+
+	// end of a value token
+	bool
+	delimiter(const char *ptr) const noexcept
+	{
+		return (ptr == last_) || space(*ptr) || (*ptr == ']') || (*ptr == '}');
+	}
+
+	bool
+	literal(std::string_view lit) noexcept
+	{
+		if( (size_t(last_ - cur_) < lit.size())
+				|| std::memcmp(cur_, lit.data(), lit.size()) )
+			return false;
+		cur_ += lit.size();
+		return true;
+	}
+
+	std::byte *
+	reserve(size_t size) noexcept
+	{
+		if(size_t(end_ - out_) < size)
+		{
+			overflow_ = true;
+			return nullptr;
+		}
+		std::byte *ptr = out_;
+		out_ += size;
+		return ptr;
+	}
+
+	bool
+	put32(uint32_t v) noexcept
+	{
+		std::byte *ptr = reserve(4);
+		if(!ptr)
+			return false;
+		store32(ptr, v);
+		return true;
+	}
+
+	bool
+	put64(uint64_t v) noexcept
+	{
+		return put32(v >> 32) && put32(v);
+	}
+
+	// zero-terminate and pad string started at from
+	bool
+	terminate(const std::byte *from) noexcept
+	{
+		const size_t len = out_ - from;
+		const size_t pad = padded(len + 1) - len;
+		std::byte *ptr = reserve(pad);
+		if(!ptr)
+			return false;
+		std::memset(ptr, 0, pad);
+		return true;
+	}
+
+	// word of printable characters up to whitespace, into output as string
+	bool
+	word(size_t &len) noexcept
+	{
+		const char *from = cur_;
+		while( (cur_ < last_) && !space(*cur_) )
+		{
+			if(!isprint(uint8_t(*cur_)))
+				return false;
+			cur_++;
+		}
+
+		len = cur_ - from;
+		std::byte *ptr = reserve(len);
+		if(!ptr)
+			return false;
+		std::memcpy(ptr, from, len);
+		return terminate(ptr);
+	}
+
+	bool
+	hex(uint64_t &v, unsigned digits) noexcept
+	{
+		if(!literal("0x") || (size_t(last_ - cur_) < 1) )
+			return false;
+
+		const auto [ptr, ec] = std::from_chars(cur_, last_, v, 16);
+		if( (ec != std::errc()) || (ptr - cur_ > digits) || !delimiter(ptr) )
+			return false;
+		cur_ = ptr;
+		return true;
+	}
+
+	template<typename T>
+	bool
+	number(T &v) noexcept
+	{
+		const auto [ptr, ec] = std::from_chars(cur_, last_, v);
+		if( (ec != std::errc()) || !delimiter(ptr) )
+			return false;
+		cur_ = ptr;
+		return true;
+	}
+
+	static int
+	nibble(char c) noexcept
+	{
+		if( (c >= '0') && (c <= '9') )
+			return c - '0';
+		if( (c >= 'a') && (c <= 'f') )
+			return c - 'a' + 10;
+		if( (c >= 'A') && (c <= 'F') )
+			return c - 'A' + 10;
+		return -1;
+	}
+
+	// one possibly escaped character within quotes
+	bool
+	unescape(uint8_t &c) noexcept
+	{
+		if(cur_ == last_)
+			return false;
+
+		if(*cur_ != '\\')
+		{
+			c = *cur_++;
+			return true;
+		}
+
+		if(++cur_ == last_)
+			return false;
+		switch(*cur_++)
+		{
+			case 'n':
+				c = '\n';
+				return true;
+			case 't':
+				c = '\t';
+				return true;
+			case 'r':
+				c = '\r';
+				return true;
+			case '\\':
+				c = '\\';
+				return true;
+			case '"':
+				c = '"';
+				return true;
+			case '\'':
+				c = '\'';
+				return true;
+			case 'x':
+			{
+				if(last_ - cur_ < 2)
+					return false;
+				const int hi = nibble(cur_[0]);
+				const int lo = nibble(cur_[1]);
+				if( (hi < 0) || (lo < 0) )
+					return false;
+				cur_ += 2;
+				c = (hi << 4) | lo;
+				return true;
+			}
+			default:
+				return false;
+		}
+	}
+
+	bool
+	string() noexcept
+	{
+		if(!literal("\""))
+			return false;
+
+		std::byte *from = out_;
+		for(;;)
+		{
+			// copy unescaped run at once
+			const char *run = cur_;
+			while( (cur_ < last_) && text_plain(uint8_t(*cur_), '"') )
+				cur_++;
+			std::byte *ptr = reserve(cur_ - run);
+			if(!ptr)
+				return false;
+			std::memcpy(ptr, run, cur_ - run);
+
+			if(cur_ == last_)
+				return false;
+			if(*cur_ == '"')
+				break;
+
+			uint8_t c;
+			if(!unescape(c) || !c)
+				return false;
+			if(!(ptr = reserve(1)))
+				return false;
+			*ptr = std::byte(c);
+		}
+
+		cur_++;
+		return terminate(from);
+	}
+
+	bool
+	character() noexcept
+	{
+		uint8_t c;
+		return literal("'") && unescape(c) && literal("'") && delimiter(cur_)
+			&& put32(c);
+	}
+
+	bool
+	blob() noexcept
+	{
+		if(!literal("0x"))
+			return false;
+
+		std::byte *size = reserve(4);
+		if(!size)
+			return false;
+
+		const char *from = cur_;
+		while( (last_ - cur_ >= 2) && !delimiter(cur_) )
+		{
+			const int hi = nibble(cur_[0]);
+			const int lo = nibble(cur_[1]);
+			if( (hi < 0) || (lo < 0) )
+				return false;
+			cur_ += 2;
+
+			std::byte *ptr = reserve(1);
+			if(!ptr)
+				return false;
+			*ptr = std::byte((hi << 4) | lo);
+		}
+		if(!delimiter(cur_))
+			return false;
+
+		const size_t len = (cur_ - from) / 2;
+		store32(size, len);
+		const size_t pad = padded(len) - len;
+		std::byte *ptr = reserve(pad);
+		if(!ptr)
+			return false;
+		std::memset(ptr, 0, pad);
+		return true;
+	}
+
+	bool
+	argument(char type) noexcept
+	{
+		switch(type)
+		{
+			case OSC_TRUE: case OSC_FALSE: case OSC_NIL: case OSC_BANG:
+				return true;
+			default:
+				break;
+		}
+
+		skip();
+		switch(type)
+		{
+			case OSC_INT32:
+			{
+				int32_t v;
+				return number(v) && put32(v);
+			}
+			case OSC_INT64:
+			{
+				int64_t v;
+				return number(v) && put64(v);
+			}
+			case OSC_FLOAT:
+			{
+				float v;
+				return number(v) && put32(std::bit_cast<uint32_t>(v));
+			}
+			case OSC_DOUBLE:
+			{
+				double v;
+				return number(v) && put64(std::bit_cast<uint64_t>(v));
+			}
+			case OSC_TIMETAG:
+			{
+				uint64_t v;
+				return hex(v, 16) && put64(v);
+			}
+			case OSC_MIDI: case OSC_RGBA:
+			{
+				uint64_t v;
+				return hex(v, 8) && put32(v);
+			}
+			case OSC_CHAR:
+				return character();
+			case OSC_STRING: case OSC_SYMBOL:
+				return string() && delimiter(cur_);
+			case OSC_BLOB:
+				return blob();
+			case OSC_AOPEN:
+				return literal("[");
+			case OSC_ACLOSE:
+				return literal("]");
+			default:
+				return false;
+		}
+	}
+
+	bool
+	message() noexcept
+	{
+		size_t len;
+		if(!word(len))
+			return false;
+
+		skip();
+		if( (cur_ == last_) || (*cur_ != ',') )
+			return false;
+
+		const char *format = cur_ + 1;
+		if(!word(len))
+			return false;
+
+		for(size_t i = 0; i < len - 1; i++)
+		{
+			if( !format[i] || !std::strchr(valid_format_chars, format[i])
+					|| !argument(format[i]) )
+				return false;
+		}
+
+		return true;
+	}
+
+	bool
+	bundle() noexcept
+	{
+		uint64_t t;
+		if(!literal("#bundle"))
+			return false;
+		skip();
+		if(!hex(t, 16))
+			return false;
+		skip();
+		if(!literal("{"))
+			return false;
+
+		std::byte *ptr = reserve(16);
+		if(!ptr)
+			return false;
+		std::memcpy(ptr, "#bundle", 8);
+		store32(ptr + 8, t >> 32);
+		store32(ptr + 12, t);
+
+		for(;;)
+		{
+			skip();
+			if(cur_ == last_)
+				return false;
+			if(*cur_ == '}')
+				break;
+
+			std::byte *size = reserve(4);
+			if(!size || !element())
+				return false;
+			store32(size, out_ - size - 4);
+		}
+
+		cur_++;
+		return true;
+	}
+
+	bool
+	element() noexcept
+	{
+		switch(*cur_)
+		{
+			case '/':
+				return message();
+			case '#':
+				return bundle();
+			default:
+				return false;
+		}
+	}
+
+	const char *cur_;
+	const char *last_;
+	std::byte *base_;
+	std::byte *out_;
+	std::byte *end_;
+	bool overflow_ = false;
+};
+
+} // namespace detail
+
+// worst-case text size of a packet of size bytes, newline included
+constexpr size_t
+text_bound(size_t size) noexcept
+{
+	return 4*size + 2;
+}
+
+// packet as text without newline, out must hold text_bound(packet.size())
+// bytes, returns end of text or nullptr if packet is malformed
+inline char *
+to_text(std::span<const std::byte> packet, char *out) noexcept
+{
+	if(packet.empty())
+		return nullptr;
+
+	switch(packet[0])
+	{
+		case std::byte{'/'}:
+			return detail::text_message(out, message_view(packet));
+		case std::byte{'#'}:
+			return detail::text_bundle(out, bundle_view(packet));
+		default:
+			return nullptr;
+	}
+}
+
+// parse one packet from the start of text, leading whitespace is skipped,
+// returns packet size and advances text past it, or 0 if text is malformed
+// or empty or out is too small
+inline size_t
+from_text(std::string_view &text, std::span<std::byte> out) noexcept
+{
+	detail::text_parser parser(text, out);
+	const size_t size = parser.packet();
+	if(size)
+		text.remove_prefix(parser.pos() - text.data());
+	return size;
+}
+
+// same, growing out as needed
+inline bool
+from_text(std::string_view &text, packet_buffer &out) noexcept
+{
+	out.clear();
+	for(;;)
+	{
+		detail::text_parser parser(text, {out.data(), out.capacity()});
+		const size_t size = parser.packet();
+		if(size)
+		{
+			out.resize(size);
+			text.remove_prefix(parser.pos() - text.data());
+			return true;
+		}
+
+		const size_t capacity = out.capacity() * 2;
+		if(!parser.overflow() || (capacity > packet_builder::max_size)
+				|| !out.reserve(capacity) )
+			return false;
+	}
+}
+
+// lines of text collected in caller storage, sink(const char *, size_t) is
+// called with full batches and on flush
+template<typename Sink>
+class text_writer
+{
+public:
+	text_writer(std::span<char> storage, Sink sink) noexcept
+		: buf_(storage), sink_(std::move(sink))
+	{}
+
+	text_writer(const text_writer &) = delete;
+	text_writer &operator=(const text_writer &) = delete;
+
+	~text_writer()
+	{
+		flush();
+	}
+
+	// false if packet is malformed or its text might not fit storage
+	bool
+	write(std::span<const std::byte> packet)
+	{
+		const size_t bound = text_bound(packet.size());
+		if(bound > buf_.size())
+		{
+			too_large_++;
+			return false;
+		}
+		if(bound > buf_.size() - size_)
+			flush();
+
+		char *end = to_text(packet, buf_.data() + size_);
+		if(!end)
+		{
+			malformed_++;
+			return false;
+		}
+
+		*end++ = '\n';
+		size_ = end - buf_.data();
+		lines_++;
+		return true;
+	}
+
+	bool
+	write(const osc_data_t *buf, size_t size)
+	{
+		return write({reinterpret_cast<const std::byte *>(buf), size});
+	}
+
+	void
+	flush()
+	{
+		if(size_)
+			sink_(buf_.data(), size_);
+		size_ = 0;
+	}
+
+	size_t
+	lines() const noexcept
+	{
+		return lines_;
+	}
+
+	size_t
+	malformed() const noexcept
+	{
+		return malformed_;
+	}
+
+	size_t
+	too_large() const noexcept
+	{
+		return too_large_;
+	}
+
+private:
+	std::span<char> buf_;
+	Sink sink_;
+	size_t size_ = 0;
+	size_t lines_ = 0;
+	size_t malformed_ = 0;
+	size_t too_large_ = 0;
+};
+
+} // namespace osc
+
+#endif /* _LIB_OSC_TEXT_HPP_ */
@@ -0,0 +1,286 @@
+/*
+ * Copyright (c) 2015 Hanspeter Portner (dev@open-music-kontrollers.ch)
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the Artistic License 2.0 as published by
+ * The Perl Foundation.
+ *
+ * This source is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * Artistic License 2.0 for more details.
+ *
+ * You should have received a copy of the Artistic License 2.0
+ * along the source as a COPYING file. If not, obtain it from
+ * http://www.perlfoundation.org/artistic_license_2_0.
+ */
+
+#ifndef _LIB_OSC_TIME_H_
+#define _LIB_OSC_TIME_H_
+
+#include <time.h>
+
+#include "osc.h"
+
+#if defined(__x86_64__)
+#	include <x86intrin.h>
+#	define OSC_TIME_TSC
+#endif
+
+/*
+ * Timetag conversion and lateness statistics.
+ *
+ * Conversions between timetags and timespecs use integer arithmetic only,
+ * nanoseconds to fraction is one constant multiply and shift. An
+ * osc_clock_t maps CLOCK_MONOTONIC, or the TSC where available, to NTP
+ * time, anchored to CLOCK_REALTIME at calibration: osc_clock_now costs one
+ * rdtsc and one multiply. Recalibrate now and then to follow NTP slewing of
+ * the system clock.
+ *
+ * osc_lateness_t keeps statistics of bundle arrival time minus timetag,
+ * fed by osc_lateness_packet for every bundle of a received packet, before
+ * it is dispatched. Immediate bundles are skipped.
+ */
+
+#define OSC_TIME_EPOCH 2208988800ULL // seconds from 1900 to 1970
+
+typedef struct _osc_clock_t osc_clock_t;
+typedef struct _osc_lateness_t osc_lateness_t;
+
+struct _osc_clock_t {
+	osc_time_t base; // NTP time at base_ticks
+	uint64_t base_ticks; // TSC or monotonic nanoseconds
+	uint64_t mult; // NTP units per tick, shifted left by OSC_CLOCK_SHIFT
+	int tsc;
+};
+
+#define OSC_CLOCK_SHIFT 32
+
+struct _osc_lateness_t {
+	uint64_t count;
+	uint64_t early; // arrived before their timetag
+	int64_t ewma; // nanoseconds, weight 1/16
+	int64_t min;
+	int64_t max;
+	uint64_t hist [64]; // by log2 of lateness in nanoseconds, early ones in 0
+};
+
+// nanoseconds below one second to 32-bit fraction, 2^32/10^9 = 4.294967296,
+// rounded up so osc_time_frac_to_nsec gives back nsec
+static inline uint32_t
+osc_time_nsec_to_frac(uint32_t nsec)
+{
+	return nsec*4 + (((uint64_t)nsec * 1266874890ULL + 0xffffffff) >> 32);
+}
+
+static inline uint32_t
+osc_time_frac_to_nsec(uint32_t frac)
+{
+	return ((uint64_t)frac * 1000000000ULL) >> 32;
+}
+
+// from timespec relative to 1970, e.g. CLOCK_REALTIME
+static inline osc_time_t
+osc_time_from_timespec(const struct timespec *ts)
+{
+	return ((uint64_t)(ts->tv_sec + OSC_TIME_EPOCH) << 32)
+		| osc_time_nsec_to_frac(ts->tv_nsec);
+}
+
+static inline void
+osc_time_to_timespec(osc_time_t t, struct timespec *ts)
+{
+	ts->tv_sec = (t >> 32) - OSC_TIME_EPOCH;
+	ts->tv_nsec = osc_time_frac_to_nsec(t & 0xffffffff);
+}
+
+// nanosecond duration to NTP duration and back
+static inline osc_time_t
+osc_time_from_nsec(uint64_t ns)
+{
+	return ((ns / 1000000000ULL) << 32)
+		| osc_time_nsec_to_frac(ns % 1000000000ULL);
+}
+
+static inline int64_t
+osc_time_to_nsec(int64_t d)
+{
+	// arithmetic shift floors the seconds, fraction stays positive
+	return (d >> 32) * 1000000000LL + osc_time_frac_to_nsec(d & 0xffffffff);
+}
+
+// (a * b) >> OSC_CLOCK_SHIFT without overflow
+static inline uint64_t
+_osc_clock_scale(uint64_t a, uint64_t b)
+{
+#if defined(__SIZEOF_INT128__)
+	return ((unsigned __int128)a * b) >> OSC_CLOCK_SHIFT;
+#else
+	// OSC_CLOCK_SHIFT is 32
+	const uint64_t ah = a >> 32, al = a & 0xffffffff;
+	const uint64_t bh = b >> 32, bl = b & 0xffffffff;
+	return ((ah * bh) << 32) + ah * bl + al * bh + ((al * bl) >> 32);
+#endif
+}
+
+static inline uint64_t
+_osc_clock_mono(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline uint64_t
+_osc_clock_ticks(const osc_clock_t *clk)
+{
+#if defined(OSC_TIME_TSC)
+	if(clk->tsc)
+		return __rdtsc();
+#endif
+	return _osc_clock_mono();
+}
+
+// anchor clock to CLOCK_REALTIME, measuring the TSC rate over window ns,
+// a window of 0 uses CLOCK_MONOTONIC only
+static inline void
+osc_clock_calibrate(osc_clock_t *clk, uint64_t window)
+{
+	clk->tsc = 0;
+	// NTP units per nanosecond, 2^32/10^9 shifted left by OSC_CLOCK_SHIFT
+	clk->mult = 18446744073ULL;
+
+#if defined(OSC_TIME_TSC)
+	if(window)
+	{
+		const uint64_t t0 = _osc_clock_mono();
+		const uint64_t c0 = __rdtsc();
+		uint64_t t1;
+		do
+			t1 = _osc_clock_mono();
+		while(t1 - t0 < window);
+		const uint64_t c1 = __rdtsc();
+
+		if(c1 > c0)
+		{
+			// NTP units per tick = 2^32 * (t1-t0) / (10^9 * (c1-c0))
+			const uint64_t ntp = osc_time_from_nsec(t1 - t0);
+			clk->mult = ((unsigned __int128)ntp << OSC_CLOCK_SHIFT) / (c1 - c0);
+			clk->tsc = 1;
+		}
+	}
+#endif
+
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	clk->base_ticks = _osc_clock_ticks(clk);
+	clk->base = osc_time_from_timespec(&ts);
+}
+
+static inline osc_time_t
+osc_clock_now(const osc_clock_t *clk)
+{
+	return clk->base + _osc_clock_scale(_osc_clock_ticks(clk) - clk->base_ticks,
+		clk->mult);
+}
+
+// NTP time of a tick value read earlier, e.g. a receive timestamp
+static inline osc_time_t
+osc_clock_at(const osc_clock_t *clk, uint64_t ticks)
+{
+	return clk->base + _osc_clock_scale(ticks - clk->base_ticks, clk->mult);
+}
+
+static inline uint64_t
+osc_clock_ticks(const osc_clock_t *clk)
+{
+	return _osc_clock_ticks(clk);
+}
+
+static inline void
+osc_lateness_init(osc_lateness_t *stats)
+{
+	memset(stats, 0, sizeof(osc_lateness_t));
+	stats->min = INT64_MAX;
+	stats->max = INT64_MIN;
+}
+
+static inline void
+osc_lateness_add(osc_lateness_t *stats, osc_time_t arrival, osc_time_t time)
+{
+	const int64_t late = osc_time_to_nsec((int64_t)(arrival - time));
+
+	if(stats->count++)
+		stats->ewma += (late - stats->ewma) / 16;
+	else
+		stats->ewma = late;
+
+	if(late < stats->min)
+		stats->min = late;
+	if(late > stats->max)
+		stats->max = late;
+
+	if(late <= 0)
+	{
+		stats->early++;
+		stats->hist[0]++;
+	}
+	else
+		stats->hist[63 - __builtin_clzll(late)]++;
+}
+
+// lateness in nanoseconds below which fraction q of samples lie, resolution
+// is a power of two, early samples count as 0
+static inline int64_t
+osc_lateness_quantile(const osc_lateness_t *stats, double q)
+{
+	const uint64_t rank = q * stats->count;
+	uint64_t seen = 0;
+
+	unsigned i;
+	for(i=0; i<64; i++)
+	{
+		seen += stats->hist[i];
+		if(seen > rank) // upper bound of bucket
+			return i ? (i < 62 ? (int64_t)2 << i : INT64_MAX) : 0;
+	}
+
+	return stats->max;
+}
+
+static inline void
+_osc_lateness_bundle(osc_lateness_t *stats, osc_time_t arrival,
+	const osc_data_t *buf, size_t size)
+{
+	osc_time_t time;
+	const osc_data_t *ptr = (size >= 16) ? osc_get_bundle(buf, &time) : NULL;
+	if(!ptr)
+		return;
+
+	if(time != OSC_IMMEDIATE)
+		osc_lateness_add(stats, arrival, time);
+
+	const osc_data_t *end = buf + size;
+	while(ptr + 4 <= end)
+	{
+		const int32_t len = be32toh(*(const int32_t *)ptr);
+		ptr += 4;
+		if( (len <= 0) || (ptr + len > end) )
+			return;
+
+		if(*ptr == '#')
+			_osc_lateness_bundle(stats, arrival, ptr, len);
+		ptr += len;
+	}
+}
+
+// account all bundles of packet received at arrival
+static inline void
+osc_lateness_packet(osc_lateness_t *stats, osc_time_t arrival,
+	const osc_data_t *buf, size_t size)
+{
+	if(size && (*buf == '#') )
+		_osc_lateness_bundle(stats, arrival, buf, size);
+}
+
+#endif /* _LIB_OSC_TIME_H_ */
@@ -0,0 +1,277 @@
+/*
+ * Copyright (c) 2015 Hanspeter Portner (dev@open-music-kontrollers.ch)
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the Artistic License 2.0 as published by
+ * The Perl Foundation.
+ *
+ * This source is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * Artistic License 2.0 for more details.
+ *
+ * You should have received a copy of the Artistic License 2.0
+ * along the source as a COPYING file. If not, obtain it from
+ * http://www.perlfoundation.org/artistic_license_2_0.
+ */
+
+#ifndef _LIB_OSC_UNROLL_H_
+#define _LIB_OSC_UNROLL_H_
+
+#include "osc.h"
+#include "osc_pool.h"
+
+/*
+ * Two-phase unrolling of large bundles.
+ *
+ * osc_unroll_index walks a bundle once and records offset, size, effective
+ * timetag and path hash of every message, in the same order in which
+ * _unroll_full injects them: messages of a bundle first, then its nested
+ * bundles. osc_unroll_dispatch then hands the messages to a callback:
+ *
+ * OSC_UNROLL_ORDER_TOTAL: on the calling thread, in index order
+ * OSC_UNROLL_ORDER_ADDRESS: in parallel, messages with the same path stay
+ *   in index order, they are partitioned by path hash in one pass over the
+ *   index, chained through the items' next field
+ * OSC_UNROLL_ORDER_NONE: in parallel, in jobs of OSC_UNROLL_JOB messages
+ *
+ * The callback must be thread-safe for the parallel modes.
+ */
+
+#ifndef OSC_UNROLL_JOB
+#	define OSC_UNROLL_JOB 64
+#endif
+
+// some partitions per thread to even out skewed addresses
+#define OSC_UNROLL_PARTS (4 * (OSC_POOL_THREADS + 1))
+#define OSC_UNROLL_END UINT32_MAX
+
+typedef enum _osc_unroll_order_t {
+	OSC_UNROLL_ORDER_NONE,
+	OSC_UNROLL_ORDER_ADDRESS,
+	OSC_UNROLL_ORDER_TOTAL
+} osc_unroll_order_t;
+
+typedef void (*osc_unroll_item_cb_t)(osc_time_t time, const osc_data_t *buf,
+	size_t size, void *data);
+
+typedef struct _osc_unroll_item_t osc_unroll_item_t;
+typedef struct _osc_unroll_index_t osc_unroll_index_t;
+
+struct _osc_unroll_item_t {
+	uint32_t offset; // from start of packet
+	uint32_t size;
+	uint32_t hash; // of path
+	uint32_t next; // next item of same partition, set by osc_unroll_dispatch
+	osc_time_t time;
+};
+
+struct _osc_unroll_index_t {
+	const osc_data_t *buf;
+	osc_unroll_item_t *items;
+	unsigned max;
+	unsigned count;
+};
+
+static inline int
+_osc_unroll_index(osc_unroll_index_t *idx, const osc_data_t *buf, size_t size)
+{
+	if( (size < 16) || strncmp((const char *)buf, "#bundle", 8) )
+		return 0;
+
+	const osc_data_t *end = buf + size;
+	const osc_time_t time = be64toh(*(const uint64_t *)(buf + 8));
+	int has_nested_bundles = 0;
+
+	const osc_data_t *ptr;
+	for(ptr=buf + 16; ptr < end; )
+	{
+		if(ptr + 4 > end)
+			return 0;
+		const int32_t hsize = be32toh(*(const int32_t *)ptr);
+		ptr += 4;
+		if( (hsize <= 0) || (ptr + hsize > end) )
+			return 0;
+
+		switch(*ptr)
+		{
+			case '#':
+				has_nested_bundles = 1;
+				break;
+			case '/':
+			{
+				if(idx->count == idx->max)
+					return 0;
+
+				osc_unroll_item_t *item = &idx->items[idx->count++];
+				item->offset = ptr - idx->buf;
+				item->size = hsize;
+				item->hash = osc_hash(ptr, strnlen((const char *)ptr, hsize));
+				item->time = time;
+				break;
+			}
+			default:
+				return 0;
+		}
+
+		ptr += hsize;
+	}
+
+	if(!has_nested_bundles)
+		return 1;
+
+	for(ptr=buf + 16; ptr < end; )
+	{
+		const int32_t hsize = be32toh(*(const int32_t *)ptr);
+		ptr += 4;
+
+		if( (*ptr == '#') && !_osc_unroll_index(idx, ptr, hsize) )
+			return 0;
+
+		ptr += hsize;
+	}
+
+	return 1;
+}
+
+// index messages of bundle or single message into items, returns number of
+// messages or -1 if packet is malformed or items is too small
+static inline int
+osc_unroll_index(const osc_data_t *buf, size_t size, osc_unroll_item_t *items,
+	unsigned max)
+{
+	osc_unroll_index_t idx = {
+		.buf = buf,
+		.items = items,
+		.max = max,
+		.count = 0
+	};
+
+	if(!size)
+		return -1;
+
+	switch(*buf)
+	{
+		case '#':
+			if(!_osc_unroll_index(&idx, buf, size))
+				return -1;
+			break;
+		case '/':
+			if(!max)
+				return -1;
+			items[0].offset = 0;
+			items[0].size = size;
+			items[0].hash = osc_hash(buf, strnlen((const char *)buf, size));
+			items[0].time = OSC_IMMEDIATE;
+			idx.count = 1;
+			break;
+		default:
+			return -1;
+	}
+
+	return idx.count;
+}
+
+typedef struct _osc_unroll_job_t osc_unroll_job_t;
+
+struct _osc_unroll_job_t {
+	const osc_data_t *buf;
+	const osc_unroll_item_t *items;
+	unsigned count;
+	uint32_t heads [OSC_UNROLL_PARTS]; // first item of each partition
+	osc_unroll_item_cb_t cb;
+	void *data;
+};
+
+static inline void
+_osc_unroll_job_chunk(unsigned job, void *data)
+{
+	const osc_unroll_job_t *ctx = (const osc_unroll_job_t *)data;
+	const unsigned from = job * OSC_UNROLL_JOB;
+	const unsigned to = (from + OSC_UNROLL_JOB < ctx->count)
+		? from + OSC_UNROLL_JOB : ctx->count;
+
+	unsigned i;
+	for(i=from; i<to; i++)
+	{
+		const osc_unroll_item_t *item = &ctx->items[i];
+		ctx->cb(item->time, ctx->buf + item->offset, item->size, ctx->data);
+	}
+}
+
+static inline void
+_osc_unroll_job_part(unsigned job, void *data)
+{
+	const osc_unroll_job_t *ctx = (const osc_unroll_job_t *)data;
+
+	uint32_t i;
+	for(i=ctx->heads[job]; i!=OSC_UNROLL_END; i=ctx->items[i].next)
+	{
+		const osc_unroll_item_t *item = &ctx->items[i];
+		ctx->cb(item->time, ctx->buf + item->offset, item->size, ctx->data);
+	}
+}
+
+// chain items into nparts partitions by path hash, keeping index order
+static inline void
+_osc_unroll_partition(osc_unroll_job_t *ctx, osc_unroll_item_t *items,
+	unsigned nparts)
+{
+	uint32_t tails [OSC_UNROLL_PARTS];
+
+	unsigned p;
+	for(p=0; p<nparts; p++)
+		ctx->heads[p] = OSC_UNROLL_END;
+
+	uint32_t i;
+	for(i=0; i<ctx->count; i++)
+	{
+		p = items[i].hash % nparts;
+		items[i].next = OSC_UNROLL_END;
+
+		if(ctx->heads[p] == OSC_UNROLL_END)
+			ctx->heads[p] = i;
+		else
+			items[tails[p]].next = i;
+		tails[p] = i;
+	}
+}
+
+// buf is the packet the items were indexed from, pool may be NULL
+static inline void
+osc_unroll_dispatch(osc_pool_t *pool, const osc_data_t *buf,
+	osc_unroll_item_t *items, unsigned count, osc_unroll_order_t order,
+	osc_unroll_item_cb_t cb, void *data)
+{
+	osc_unroll_job_t ctx = {
+		.buf = buf,
+		.items = items,
+		.count = count,
+		.cb = cb,
+		.data = data
+	};
+
+	switch(order)
+	{
+		case OSC_UNROLL_ORDER_NONE:
+			osc_pool_run(pool, (count + OSC_UNROLL_JOB - 1) / OSC_UNROLL_JOB,
+				_osc_unroll_job_chunk, &ctx);
+			break;
+		case OSC_UNROLL_ORDER_ADDRESS:
+			if(pool && pool->nthreads && (count > OSC_UNROLL_JOB) )
+			{
+				const unsigned nparts = 4 * (pool->nthreads + 1);
+				_osc_unroll_partition(&ctx, items, nparts);
+				osc_pool_run(pool, nparts, _osc_unroll_job_part, &ctx);
+				break;
+			}
+			// a single partition is just index order
+			// fall through
+		case OSC_UNROLL_ORDER_TOTAL: // without pool, jobs run in order
+			osc_pool_run(NULL, (count + OSC_UNROLL_JOB - 1) / OSC_UNROLL_JOB,
+				_osc_unroll_job_chunk, &ctx);
+			break;
+	}
+}
+
+#endif /* _LIB_OSC_UNROLL_H_ */
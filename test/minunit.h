@@ -22,14 +22,23 @@
 	}                                                        \
 } while (0)
 
+/* like mu_assert, failing the test function right away */
+#define mu_check(test) do {                                      \
+	if (!(test)) {                                           \
+		fprintf(PRINTAT, "ASSERT: %s:%d: %s\n",          \
+		    __FILE__, __LINE__, #test);                  \
+		return 1;                                        \
+	}                                                        \
+} while (0)
+
 #define mu_run_test(name, test) do {                        \
 	if (test() == 0) {                                  \
 		tests_pass++;                               \
-		fprintf(PRINTAT, "FAIL: %s:%d: " name "\n", \
+		fprintf(PRINTAT, "PASS: %s:%d: " name "\n", \
 		    __FILE__, __LINE__);                    \
 	} else {                                            \
 		tests_fail++;                               \
-		fprintf(PRINTAT, "PASS: %s:%d: " name "\n", \
+		fprintf(PRINTAT, "FAIL: %s:%d: " name "\n", \
 		    __FILE__, __LINE__);                    \
 	}                                                   \
 	tests_run++;                                        \
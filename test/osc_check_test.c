@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) 2015 Hanspeter Portner (dev@open-music-kontrollers.ch)
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the Artistic License 2.0 as published by
+ * The Perl Foundation.
+ *
+ * This source is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * Artistic License 2.0 for more details.
+ *
+ * You should have received a copy of the Artistic License 2.0
+ * along the source as a COPYING file. If not, obtain it from
+ * http://www.perlfoundation.org/artistic_license_2_0.
+ */
+
+// cc -std=gnu11 -O2 -pthread -fsanitize=thread -I.. osc_check_test.c
+
+#include <stdlib.h>
+
+#include "../osc_check.h"
+#include "minunit.h"
+
+#define NITEMS 2000 // several jobs, last bitmap word partially used
+#define MAX_SIZE 256
+
+int tests_run = 0;
+int tests_pass = 0;
+int tests_fail = 0;
+
+static osc_data_t bufs [NITEMS][MAX_SIZE];
+static osc_check_item_t items [NITEMS];
+
+// mix of valid messages and bundles, truncated and corrupted packets
+static void
+_fill(unsigned seed)
+{
+	srand(seed);
+
+	unsigned i;
+	for(i=0; i<NITEMS; i++)
+	{
+		osc_data_t *buf = bufs[i];
+		const osc_data_t *end = buf + MAX_SIZE;
+		osc_data_t *ptr = buf;
+
+		if(i % 3 == 0)
+		{
+			osc_data_t *bndl;
+			osc_data_t *itm;
+			ptr = osc_start_bundle(ptr, end, OSC_IMMEDIATE, &bndl);
+			ptr = osc_start_bundle_item(ptr, end, &itm);
+			ptr = osc_set_vararg(ptr, end, "/bundled", "if", i, 1.f);
+			ptr = osc_end_bundle_item(ptr, end, itm);
+			ptr = osc_end_bundle(ptr, end, bndl);
+		}
+		else
+			ptr = osc_set_vararg(ptr, end, "/check", "isf", i, "test", 2.f);
+
+		size_t size = ptr - buf;
+		switch(rand() % 4)
+		{
+			case 0: // truncate
+				size -= 1 + rand() % 8;
+				break;
+			case 1: // flip a byte
+				buf[rand() % size] ^= 1 + rand() % 255;
+				break;
+			case 2: // empty
+				if(rand() % 8 == 0)
+					size = 0;
+				break;
+		}
+
+		items[i].buf = buf;
+		items[i].size = size;
+	}
+}
+
+// bitmap and reasons must match osc_check_packet_reason one by one
+static int
+_compare(unsigned n, const uint64_t *valid, const osc_check_t *reasons,
+	unsigned nvalid)
+{
+	unsigned count = 0;
+
+	unsigned i;
+	for(i=0; i<n; i++)
+	{
+		const osc_check_t reason = items[i].size
+			? osc_check_packet_reason(items[i].buf, items[i].size)
+			: OSC_CHECK_TYPE;
+		const int ok = (reason == OSC_CHECK_OK);
+
+		mu_check(reasons[i] == reason);
+		mu_check(!!(valid[i / 64] & (1ULL << (i % 64))) == ok);
+		mu_check(ok == (items[i].size ? osc_check_packet(items[i].buf, items[i].size) : 0));
+		count += ok;
+	}
+
+	mu_check(count == nvalid);
+
+	return 0;
+}
+
+static int
+test_batch(void)
+{
+	static uint64_t valid [(NITEMS + 63) / 64];
+	static osc_check_t reasons [NITEMS];
+
+	unsigned seed;
+	for(seed=0; seed<8; seed++)
+	{
+		_fill(seed);
+
+		unsigned n;
+		for(n=1; n<=NITEMS; n+=n/2 + 1) // odd sizes too
+		{
+			memset(valid, 0xff, sizeof(valid));
+			const unsigned nvalid = osc_check_batch(items, n, valid, reasons);
+			mu_check(_compare(n, valid, reasons, nvalid) == 0);
+		}
+	}
+
+	return 0;
+}
+
+static int
+test_batch_parallel(void)
+{
+	static uint64_t valid [(NITEMS + 63) / 64];
+	static uint64_t valid2 [(NITEMS + 63) / 64];
+	static osc_check_t reasons [NITEMS];
+
+	osc_pool_t pool;
+	mu_check(osc_pool_init(&pool, 3));
+
+	unsigned seed;
+	for(seed=0; seed<8; seed++)
+	{
+		_fill(seed);
+
+		unsigned n;
+		for(n=OSC_CHECK_JOB - 1; n<=NITEMS; n+=97)
+		{
+			memset(valid, 0xff, sizeof(valid));
+			const unsigned nvalid = osc_check_batch_parallel(&pool, items, n, valid,
+				reasons);
+			mu_check(_compare(n, valid, reasons, nvalid) == 0);
+
+			// without reasons and without pool
+			mu_check(osc_check_batch_parallel(&pool, items, n, valid2, NULL) == nvalid);
+			mu_check(!memcmp(valid, valid2, (n + 63) / 64 * sizeof(uint64_t)));
+			mu_check(osc_check_batch_parallel(NULL, items, n, valid2, NULL) == nvalid);
+			mu_check(!memcmp(valid, valid2, (n + 63) / 64 * sizeof(uint64_t)));
+		}
+	}
+
+	osc_pool_deinit(&pool);
+
+	return 0;
+}
+
+static void
+_count_job(unsigned job, void *data)
+{
+	atomic_uint *counts = data;
+
+	atomic_fetch_add_explicit(&counts[job], 1, memory_order_relaxed);
+}
+
+// every job runs exactly once, whatever the number of threads
+static int
+test_pool(void)
+{
+	static atomic_uint counts [1000];
+
+	unsigned nthreads;
+	for(nthreads=0; nthreads<=OSC_POOL_THREADS; nthreads+=2)
+	{
+		osc_pool_t pool;
+		mu_check(osc_pool_init(&pool, nthreads));
+
+		unsigned njobs;
+		for(njobs=0; njobs<=1000; njobs+=njobs + 1)
+		{
+			unsigned i;
+			for(i=0; i<njobs; i++)
+				atomic_init(&counts[i], 0);
+
+			osc_pool_run(&pool, njobs, _count_job, counts);
+
+			for(i=0; i<njobs; i++)
+				mu_check(atomic_load(&counts[i]) == 1);
+		}
+
+		osc_pool_deinit(&pool);
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	(void)argc;
+	(void)argv;
+
+	mu_run_test("batch", test_batch);
+	mu_run_test("batch_parallel", test_batch_parallel);
+	mu_run_test("pool", test_pool);
+
+	fprintf(stderr, "%d tests run, %d passed, %d failed\n", tests_run,
+		tests_pass, tests_fail);
+
+	return tests_fail ? 1 : 0;
+}
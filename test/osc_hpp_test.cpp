@@ -0,0 +1,233 @@
+/*
+ * Copyright (c) 2015 Hanspeter Portner (dev@open-music-kontrollers.ch)
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the Artistic License 2.0 as published by
+ * The Perl Foundation.
+ *
+ * This source is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * Artistic License 2.0 for more details.
+ *
+ * You should have received a copy of the Artistic License 2.0
+ * along the source as a COPYING file. If not, obtain it from
+ * http://www.perlfoundation.org/artistic_license_2_0.
+ */
+
+// c++ -std=c++20 -D_GLIBCXX_ASSERTIONS -fsanitize=address,undefined osc_hpp_test.cpp
+
+#include <cstdarg>
+#include <cstdlib>
+
+#include "../osc.hpp"
+#include "minunit.h"
+
+int tests_run = 0;
+int tests_pass = 0;
+int tests_fail = 0;
+
+// touch everything a view offers, must stay within buf
+static size_t
+_walk(const osc::message_view &msg)
+{
+	size_t n = msg.valid() + msg.path().size() + msg.format().size();
+
+	for(const osc::argument arg : msg)
+		n += arg.data().size();
+	for(size_t i = 0; i < msg.size() + 2; i++)
+		n += msg[i].data().size();
+
+	return n;
+}
+
+static int
+test_truncated_header(void)
+{
+	static const char raw [] = "/a\0\0,f\0"; // format padding cut off
+	const osc::message_view msg(reinterpret_cast<const osc_data_t *>(raw),
+		sizeof(raw) - 1);
+
+	mu_check(!msg.header_valid());
+	mu_check(!msg.valid());
+	mu_check(msg.size() == 0);
+	mu_check(msg[0].type() == '\0');
+	mu_check(msg.begin() == msg.end());
+
+	return 0;
+}
+
+// every prefix of valid messages is handled without reading past it
+static int
+test_truncated(void)
+{
+	osc_data_t buf [256];
+	osc_data_t *end = osc_set_vararg(buf, buf + sizeof(buf), "/trunc",
+		"ifsbhdtc", 1, 2.0, "three", 4, "four", (int64_t)5, 6.0, (uint64_t)7, 'c');
+	mu_check(end);
+	const size_t size = end - buf;
+
+	mu_check(osc::message_view(buf, size).valid());
+	mu_check(osc::message_view(buf, size).get<int32_t>(0) == 1);
+
+	for(size_t len = 0; len < size; len++)
+	{
+		// copy, so sanitizers catch reads past the prefix
+		osc_data_t *copy = static_cast<osc_data_t *>(std::malloc(len ? len : 1));
+		std::memcpy(copy, buf, len);
+
+		const osc::message_view msg(copy, len);
+		mu_check(!msg.valid());
+		_walk(msg);
+
+		std::free(copy);
+	}
+
+	return 0;
+}
+
+// random garbage behind a valid path
+static int
+test_garbage(void)
+{
+	std::srand(1);
+
+	for(unsigned i = 0; i < 100000; i++)
+	{
+		const size_t len = 4 + std::rand() % 28;
+		osc_data_t *copy = static_cast<osc_data_t *>(std::malloc(len));
+		std::memcpy(copy, "/ab", 4);
+		for(size_t j = 4; j < len; j++)
+		{
+			static const char pool [] = ",ifsbhdtcTFNI[]\0\0\0\x01\x7f";
+			copy[j] = pool[std::rand() % (sizeof(pool) - 1)];
+		}
+
+		_walk(osc::message_view(copy, len));
+
+		std::free(copy);
+	}
+
+	return 0;
+}
+
+// handlers record their id in the context
+typedef struct _calls_t calls_t;
+
+struct _calls_t {
+	unsigned n;
+	int ids [8];
+};
+
+template<int ID, bool TAKE>
+static bool
+_take(osc_time_t, const osc::message_view &, calls_t &calls)
+{
+	calls.ids[calls.n++] = ID;
+	return TAKE;
+}
+
+template<int ID>
+static void
+_void(osc_time_t, const osc::message_view &, calls_t &calls)
+{
+	calls.ids[calls.n++] = ID;
+}
+
+using table = osc::method_table<
+	osc::method<"/chain", "i", _take<1, false>>, // declines
+	osc::method<"/chain", "*", _take<2, true>>,
+	osc::method<"/chain", "*", _take<3, true>>, // shadowed
+	osc::method<"/void", "i", _void<4>>,
+	osc::method<"/void", "i", _take<5, true>>, // void before stops
+	osc::method<"/format", "f", _take<6, true>>,
+	osc::method<"*", "s", _take<7, false>>,
+	osc::method<"*", "*", _void<8>>>;
+
+using bare = osc::method_table<
+	osc::method<"/only", "i", _take<1, true>>>;
+
+// dispatch single message, returns handler ids in call order
+static calls_t
+_dispatch(const char *path, const char *fmt, ...)
+{
+	osc_data_t buf [128];
+	va_list args;
+	va_start(args, fmt);
+	osc_data_t *end = osc_set_varlist(buf, buf + sizeof(buf), path, fmt, args);
+	va_end(args);
+
+	calls_t calls = {};
+	table::dispatch(buf, end - buf, calls);
+	return calls;
+}
+
+static int
+test_method_table(void)
+{
+	calls_t calls;
+
+	calls = _dispatch("/chain", "i", 1);
+	mu_check( (calls.n == 2) && (calls.ids[0] == 1) && (calls.ids[1] == 2) );
+
+	calls = _dispatch("/chain", "f", 1.f);
+	mu_check( (calls.n == 1) && (calls.ids[0] == 2) );
+
+	calls = _dispatch("/void", "i", 1);
+	mu_check( (calls.n == 1) && (calls.ids[0] == 4) );
+
+	// format miss falls through to the "*" entries
+	calls = _dispatch("/format", "i", 1);
+	mu_check( (calls.n == 1) && (calls.ids[0] == 8) );
+
+	// path miss, "*" entries in order
+	calls = _dispatch("/other", "s", "x");
+	mu_check( (calls.n == 2) && (calls.ids[0] == 7) && (calls.ids[1] == 8) );
+
+	// no catch-all, misses are not taken
+	osc_data_t buf [64];
+	osc_data_t *end = osc_set_vararg(buf, buf + sizeof(buf), "/other", "i", 1);
+	calls = {};
+	mu_check(bare::dispatch(buf, end - buf, calls) == 0);
+	end = osc_set_vararg(buf, buf + sizeof(buf), "/only", "f", 1.f);
+	mu_check(bare::dispatch(buf, end - buf, calls) == 0);
+	end = osc_set_vararg(buf, buf + sizeof(buf), "/only", "i", 1);
+	mu_check(bare::dispatch(buf, end - buf, calls) == 1);
+	mu_check( (calls.n == 1) && (calls.ids[0] == 1) );
+
+	// bundle, each message counts
+	osc_data_t *ptr = buf;
+	osc_data_t *itm = NULL;
+	osc_data_t *bndl = NULL;
+	ptr = osc_start_bundle(ptr, buf + sizeof(buf), OSC_IMMEDIATE, &bndl);
+	ptr = osc_start_bundle_item(ptr, buf + sizeof(buf), &itm);
+	ptr = osc_set_vararg(ptr, buf + sizeof(buf), "/chain", "i", 1);
+	ptr = osc_end_bundle_item(ptr, buf + sizeof(buf), itm);
+	ptr = osc_start_bundle_item(ptr, buf + sizeof(buf), &itm);
+	ptr = osc_set_vararg(ptr, buf + sizeof(buf), "/void", "i", 1);
+	ptr = osc_end_bundle_item(ptr, buf + sizeof(buf), itm);
+	ptr = osc_end_bundle(ptr, buf + sizeof(buf), bndl);
+	mu_check(ptr);
+	calls = {};
+	mu_check(table::dispatch(buf, ptr - buf, calls) == 2);
+	mu_check( (calls.n == 3) && (calls.ids[2] == 4) );
+
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	(void)argc;
+	(void)argv;
+
+	mu_run_test("truncated_header", test_truncated_header);
+	mu_run_test("truncated", test_truncated);
+	mu_run_test("garbage", test_garbage);
+	mu_run_test("method_table", test_method_table);
+
+	fprintf(stderr, "%d tests run, %d passed, %d failed\n", tests_run,
+		tests_pass, tests_fail);
+
+	return tests_fail ? 1 : 0;
+}
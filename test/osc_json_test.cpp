@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) 2015 Hanspeter Portner (dev@open-music-kontrollers.ch)
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the Artistic License 2.0 as published by
+ * The Perl Foundation.
+ *
+ * This source is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * Artistic License 2.0 for more details.
+ *
+ * You should have received a copy of the Artistic License 2.0
+ * along the source as a COPYING file. If not, obtain it from
+ * http://www.perlfoundation.org/artistic_license_2_0.
+ */
+
+// c++ -std=c++20 -mssse3 -D_GLIBCXX_ASSERTIONS -fsanitize=address,undefined osc_json_test.cpp
+
+#include <cstdlib>
+#include <string>
+
+#include "../osc_json.hpp"
+#include "minunit.h"
+
+int tests_run = 0;
+int tests_pass = 0;
+int tests_fail = 0;
+
+// message /a with format fmt and a single int32 per 'i'
+static std::string
+_array_message(const char *fmt)
+{
+	std::string msg("/a\0\0,", 5);
+	msg += fmt;
+	msg.append(4 - (msg.size() % 4), '\0');
+	for(const char *c = fmt; *c; c++)
+		if(*c == 'i')
+			msg.append("\0\0\0\x07", 4);
+	return msg;
+}
+
+static const char *
+_to_json(const std::string &msg, char *out)
+{
+	char *end = osc::to_json({reinterpret_cast<const std::byte *>(msg.data()),
+		msg.size()}, out);
+	if(!end)
+		return nullptr;
+	*end = '\0';
+	return out;
+}
+
+static int
+test_arrays(void)
+{
+	char out [256];
+	const char *json;
+
+	json = _to_json(_array_message("[i[i]i]"), out);
+	mu_check(json && !std::strcmp(json,
+		"{\"path\":\"/a\",\"types\":\"[i[i]i]\",\"args\":[[7,[7],7]]}\n"));
+
+	json = _to_json(_array_message("[]"), out);
+	mu_check(json && !std::strcmp(json,
+		"{\"path\":\"/a\",\"types\":\"[]\",\"args\":[[]]}\n"));
+
+	// unbalanced
+	mu_check(!_to_json(_array_message("]"), out));
+	mu_check(!_to_json(_array_message("i]i"), out));
+	mu_check(!_to_json(_array_message("[i]]"), out));
+	mu_check(!_to_json(_array_message("["), out));
+	mu_check(!_to_json(_array_message("[[i]"), out));
+
+	return 0;
+}
+
+// vector paths against the scalar tail, which handles short inputs alone
+static int
+test_string_scalar(void)
+{
+	std::srand(1);
+
+	for(unsigned i = 0; i < 10000; i++)
+	{
+		char str [80];
+		const size_t len = std::rand() % sizeof(str);
+		for(size_t j = 0; j < len; j++)
+		{
+			// bias towards characters to escape
+			static const char pool [] = "\"\\\n\t\x01\x1f\x20\x7f\x80\xff";
+			str[j] = (std::rand() % 4) ? char(std::rand())
+				: pool[std::rand() % (sizeof(pool) - 1)];
+		}
+
+		char full [6*sizeof(str) + 2];
+		char *end = osc::detail::json_string(full, str, len);
+
+		std::string ref("\"");
+		for(size_t j = 0; j < len; j++)
+		{
+			char one [8];
+			const char *e = osc::detail::json_string(one, str + j, 1);
+			ref.append(one + 1, e - one - 2);
+		}
+		ref += '"';
+
+		mu_check(std::string(full, end) == ref);
+	}
+
+	return 0;
+}
+
+static int
+test_base64_scalar(void)
+{
+	std::srand(2);
+
+	for(unsigned i = 0; i < 10000; i++)
+	{
+		uint8_t src [80];
+		const size_t len = std::rand() % sizeof(src);
+		for(size_t j = 0; j < len; j++)
+			src[j] = std::rand();
+
+		char full [4*sizeof(src)/3 + 8];
+		char *end = osc::detail::json_base64(full, src, len);
+
+		std::string ref("\"");
+		for(size_t j = 0; j < len; j += 3)
+		{
+			char group [8];
+			const char *e = osc::detail::json_base64(group, src + j,
+				(len - j < 3) ? len - j : 3);
+			ref.append(group + 1, e - group - 2);
+		}
+		ref += '"';
+
+		mu_check(std::string(full, end) == ref);
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	(void)argc;
+	(void)argv;
+
+	mu_run_test("arrays", test_arrays);
+	mu_run_test("string_scalar", test_string_scalar);
+	mu_run_test("base64_scalar", test_base64_scalar);
+
+	fprintf(stderr, "%d tests run, %d passed, %d failed\n", tests_run,
+		tests_pass, tests_fail);
+
+	return tests_fail ? 1 : 0;
+}
@@ -0,0 +1,279 @@
+/*
+ * Copyright (c) 2015 Hanspeter Portner (dev@open-music-kontrollers.ch)
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the Artistic License 2.0 as published by
+ * The Perl Foundation.
+ *
+ * This source is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * Artistic License 2.0 for more details.
+ *
+ * You should have received a copy of the Artistic License 2.0
+ * along the source as a COPYING file. If not, obtain it from
+ * http://www.perlfoundation.org/artistic_license_2_0.
+ */
+
+// cc -std=gnu11 -O2 -fsanitize=address,undefined -I.. osc_lanes_test.c
+
+#include "../osc_lanes.h"
+#include "minunit.h"
+
+#define NLOG 64
+
+int tests_run = 0;
+int tests_pass = 0;
+int tests_fail = 0;
+
+static uint64_t storage [3][32]; // 256 bytes per lane
+
+// dispatch order as lane and int32 argument
+typedef struct _log_t log_t;
+
+struct _log_t {
+	unsigned n;
+	unsigned lane [NLOG];
+	int32_t seq [NLOG];
+	int corrupt;
+};
+
+static log_t logged;
+
+static size_t
+_message(osc_data_t *buf, size_t size, const char *path, const char *fmt,
+	int32_t seq)
+{
+	osc_data_t *end;
+	if(fmt[1] == 's') // padding string, varies record size
+	{
+		char pad [64];
+		memset(pad, 'x', seq % 48);
+		pad[seq % 48] = '\0';
+		end = osc_set_vararg(buf, buf + size, path, fmt, seq, pad);
+	}
+	else
+		end = osc_set_vararg(buf, buf + size, path, fmt, seq);
+
+	return end ? (size_t)(end - buf) : 0;
+}
+
+static void
+_dispatch(unsigned lane, const osc_data_t *buf, size_t size, void *data)
+{
+	log_t *log = data;
+	const size_t len = strnlen((const char *)buf, size);
+	const osc_data_t *ptr = buf + OSC_PADDED_SIZE(len + 1);
+	ptr += osc_strlen((const char *)ptr); // format
+
+	int32_t seq;
+	if( (len == size) || (ptr + 4 > buf + size) )
+	{
+		log->corrupt = 1;
+		return;
+	}
+	osc_get_int32(ptr, &seq);
+
+	if(log->n < NLOG)
+	{
+		log->lane[log->n] = lane;
+		log->seq[log->n] = seq;
+	}
+	log->n++;
+}
+
+static int
+_push(osc_lanes_t *lanes, unsigned idx, const char *path, int32_t seq,
+	uint64_t now)
+{
+	osc_data_t buf [128];
+	const size_t size = _message(buf, sizeof(buf), path, "i", seq);
+	return osc_lanes_push(lanes, idx, buf, size, now);
+}
+
+static int
+test_classify(void)
+{
+	static const osc_lane_rule_t rules [] = {
+		{.prefix = "/ctl", .lane = 1},
+		{.prefix = "/gone", .lane = 7},
+		{.prefix = NULL}
+	};
+	static osc_schema_t schemas [] = {
+		{.path = "/plain", .fmt = "i"}, // no annotation
+		{.path = "/first", .fmt = "i", .lane = OSC_SCHEMA_LANE(0)},
+		{.path = "/second", .fmt = "i"},
+		{.path = "/second", .fmt = "f", .lane = OSC_SCHEMA_LANE(1)},
+		{.path = "/ctl", .fmt = "i", .lane = OSC_SCHEMA_LANE(0)}, // rule wins
+		{.path = "/far", .fmt = "i", .lane = OSC_SCHEMA_LANE(5)},
+		{.path = NULL}
+	};
+	osc_schema_registry_t reg;
+	osc_lanes_t lanes;
+	osc_data_t buf [128];
+
+	mu_check(osc_schema_registry_init(&reg, schemas));
+	osc_lanes_init(&lanes, rules, &reg, 2);
+	for(unsigned i = 0; i < 3; i++)
+		mu_check(osc_lanes_add(&lanes, storage[i], sizeof(storage[i]),
+			OSC_LANE_WEIGHTED, 1, 0) == (int)i);
+
+	static const struct {
+		const char *path;
+		unsigned lane;
+	} cases [] = {
+		{"/plain", 2},
+		{"/first", 0},
+		{"/second", 1},
+		{"/ctl", 1},
+		{"/ctl/gain", 1},
+		{"/ctlx", 2},
+		{"/gone", 2},
+		{"/far", 2},
+		{"/unknown", 2}
+	};
+
+	for(unsigned i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+	{
+		const size_t size = _message(buf, sizeof(buf), cases[i].path, "i", 0);
+		mu_check(osc_lanes_classify(&lanes, buf, size) == cases[i].lane);
+	}
+
+	return 0;
+}
+
+// variable-size records wrapping the ring many times, in order and intact
+static int
+test_wrap(void)
+{
+	osc_lanes_t lanes;
+	osc_data_t buf [128];
+
+	osc_lanes_init(&lanes, NULL, NULL, 0);
+	mu_check(osc_lanes_add(&lanes, storage[0], sizeof(storage[0]),
+		OSC_LANE_WEIGHTED, 1, 0) == 0);
+
+	int32_t pushed = 0;
+	int32_t expect = 0;
+	for(unsigned round = 0; round < 1000; round++)
+	{
+		// fill until full, then drain
+		for(;;)
+		{
+			const size_t size = _message(buf, sizeof(buf), "/w", "is", pushed);
+			if(!osc_lanes_push(&lanes, 0, buf, size, 0))
+				break;
+			pushed++;
+		}
+
+		memset(&logged, 0, sizeof(logged));
+		const unsigned n = osc_lanes_poll(&lanes, 0, NLOG, _dispatch, &logged);
+		mu_check(!logged.corrupt);
+		mu_check(n && (n == logged.n) && (n < NLOG) );
+		for(unsigned i = 0; i < n; i++)
+			mu_check(logged.seq[i] == expect++);
+	}
+	mu_check(expect == pushed);
+
+	osc_lane_stats_t stats;
+	osc_lanes_stats(&lanes, 0, &stats);
+	mu_check(stats.depth == 0);
+	mu_check(stats.bytes == 0);
+	mu_check(stats.enqueued == (unsigned long)pushed);
+	mu_check(stats.dropped == 1000);
+
+	return 0;
+}
+
+// strict lanes go first regardless of arrival
+static int
+test_strict(void)
+{
+	osc_lanes_t lanes;
+
+	osc_lanes_init(&lanes, NULL, NULL, 0);
+	mu_check(osc_lanes_add(&lanes, storage[0], sizeof(storage[0]),
+		OSC_LANE_WEIGHTED, 1, 0) == 0);
+	mu_check(osc_lanes_add(&lanes, storage[1], sizeof(storage[1]),
+		OSC_LANE_STRICT, 1, 0) == 1);
+	mu_check(osc_lanes_add(&lanes, storage[2], sizeof(storage[2]),
+		OSC_LANE_STRICT, 1, 0) == 2);
+
+	mu_check(_push(&lanes, 0, "/bulk", 0, 0));
+	mu_check(_push(&lanes, 0, "/bulk", 1, 0));
+	mu_check(_push(&lanes, 2, "/low", 2, 1));
+	mu_check(_push(&lanes, 1, "/high", 3, 2));
+	mu_check(_push(&lanes, 1, "/high", 4, 3));
+
+	memset(&logged, 0, sizeof(logged));
+	mu_check(osc_lanes_poll(&lanes, 10, NLOG, _dispatch, &logged) == 5);
+
+	static const unsigned lane [5] = {1, 1, 2, 0, 0};
+	static const int32_t seq [5] = {3, 4, 2, 0, 1};
+	for(unsigned i = 0; i < 5; i++)
+		mu_check( (logged.lane[i] == lane[i]) && (logged.seq[i] == seq[i]) );
+
+	return 0;
+}
+
+// overdue lanes by earliest deadline, then round-robin by weight
+static int
+test_budget(void)
+{
+	osc_lanes_t lanes;
+
+	osc_lanes_init(&lanes, NULL, NULL, 0);
+	mu_check(osc_lanes_add(&lanes, storage[0], sizeof(storage[0]),
+		OSC_LANE_WEIGHTED, 2, 0) == 0);
+	mu_check(osc_lanes_add(&lanes, storage[1], sizeof(storage[1]),
+		OSC_LANE_WEIGHTED, 1, 100) == 1);
+	mu_check(osc_lanes_add(&lanes, storage[2], sizeof(storage[2]),
+		OSC_LANE_WEIGHTED, 1, 50) == 2);
+
+	// deadlines: lane 1 at 100 and 110, lane 2 at 70
+	mu_check(_push(&lanes, 0, "/a", 0, 0));
+	mu_check(_push(&lanes, 0, "/a", 1, 0));
+	mu_check(_push(&lanes, 0, "/a", 2, 0));
+	mu_check(_push(&lanes, 1, "/b", 3, 0));
+	mu_check(_push(&lanes, 1, "/b", 4, 10));
+	mu_check(_push(&lanes, 2, "/c", 5, 20));
+
+	// none overdue yet, round-robin with weight 2 for lane 0
+	memset(&logged, 0, sizeof(logged));
+	mu_check(osc_lanes_poll(&lanes, 60, 1, _dispatch, &logged) == 1);
+	mu_check(osc_lanes_poll(&lanes, 60, 1, _dispatch, &logged) == 1);
+	mu_check( (logged.lane[0] == 0) && (logged.lane[1] == 0) );
+
+	// all of lanes 1 and 2 overdue, earliest deadline first
+	mu_check(osc_lanes_poll(&lanes, 200, NLOG, _dispatch, &logged) == 4);
+	static const unsigned lane [6] = {0, 0, 2, 1, 1, 0};
+	static const int32_t seq [6] = {0, 1, 5, 3, 4, 2};
+	for(unsigned i = 0; i < 6; i++)
+		mu_check( (logged.lane[i] == lane[i]) && (logged.seq[i] == seq[i]) );
+
+	osc_lane_stats_t stats;
+	osc_lanes_stats(&lanes, 1, &stats);
+	mu_check( (stats.dispatched == 2) && (stats.misses == 2) );
+	mu_check(stats.latency_max == 200);
+	osc_lanes_stats(&lanes, 0, &stats);
+	mu_check( (stats.dispatched == 3) && (stats.misses == 0) );
+
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	(void)argc;
+	(void)argv;
+
+	mu_run_test("classify", test_classify);
+	mu_run_test("wrap", test_wrap);
+	mu_run_test("strict", test_strict);
+	mu_run_test("budget", test_budget);
+
+	fprintf(stderr, "%d tests run, %d passed, %d failed\n", tests_run,
+		tests_pass, tests_fail);
+
+	return tests_fail ? 1 : 0;
+}
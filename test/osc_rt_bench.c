@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2015 Hanspeter Portner (dev@open-music-kontrollers.ch)
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the Artistic License 2.0 as published by
+ * The Perl Foundation.
+ *
+ * This source is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * Artistic License 2.0 for more details.
+ *
+ * You should have received a copy of the Artistic License 2.0
+ * along the source as a COPYING file. If not, obtain it from
+ * http://www.perlfoundation.org/artistic_license_2_0.
+ */
+
+// cc -std=gnu11 -O2 -I.. osc_rt_bench.c -ldl -pthread
+// ./a.out [iterations], best run pinned on an isolated core, e.g. with
+// chrt -f 80 taskset -c 3 ./a.out
+
+#define _GNU_SOURCE
+#define OSC_RT_AUDIT_HOOKS
+
+#include <stdlib.h>
+
+#include "../osc_rt.h"
+#include "../osc.h"
+#include "../osc_cache.h"
+#include "../osc_fmt.h"
+#include "../osc_unroll.h"
+
+#define NMSGS 32 // per bundle
+
+static int
+_method_cb(osc_time_t time, const char *path, const char *fmt,
+	const osc_data_t *buf, size_t size, void *data)
+{
+	(void)time;
+	(void)path;
+	(void)fmt;
+	(void)buf;
+	(void)size;
+	(void)data;
+
+	return 0;
+}
+
+static void
+_unroll_cb(osc_time_t time, const osc_data_t *buf, size_t size, void *data)
+{
+	(void)time;
+	(void)buf;
+	(void)size;
+	(void)data;
+}
+
+static const osc_method_t methods [] = {
+	{"/gain", "if", _method_cb},
+	{"/pan", "f", _method_cb},
+	{"/name", "s", _method_cb},
+	{NULL, NULL, NULL}
+};
+
+static osc_data_t *
+_encode(osc_data_t *buf, const osc_data_t *end, unsigned seq)
+{
+	osc_data_t *bndl = NULL;
+	osc_data_t *ptr = osc_start_bundle(buf, end, OSC_IMMEDIATE, &bndl);
+
+	unsigned i;
+	for(i=0; i<NMSGS; i++)
+	{
+		osc_data_t *itm = NULL;
+		ptr = osc_start_bundle_item(ptr, end, &itm);
+		switch(i % 3)
+		{
+			case 0:
+				ptr = osc_set_vararg(ptr, end, "/gain", "if", seq + i, 0.5);
+				break;
+			case 1:
+				ptr = osc_set_vararg(ptr, end, "/pan", "f", 0.25);
+				break;
+			case 2:
+				ptr = osc_set_vararg(ptr, end, "/name", "s", "channel");
+				break;
+		}
+		ptr = osc_end_bundle_item(ptr, end, itm);
+	}
+
+	return osc_end_bundle(ptr, end, bndl);
+}
+
+int
+main(int argc, char **argv)
+{
+	const unsigned iterations = (argc > 1) ? strtoul(argv[1], NULL, 10) : 1000000;
+
+	static osc_data_t buf [4096];
+	static osc_cache_t cache;
+	static osc_fmt_cache_t fmt_cache;
+	static osc_unroll_item_t items [NMSGS];
+	static osc_rt_hist_t h_encode, h_check, h_dispatch, h_cached, h_compiled,
+		h_unroll;
+
+	osc_rt_hist_init(&h_encode);
+	osc_rt_hist_init(&h_check);
+	osc_rt_hist_init(&h_dispatch);
+	osc_rt_hist_init(&h_cached);
+	osc_rt_hist_init(&h_compiled);
+	osc_rt_hist_init(&h_unroll);
+	osc_cache_init(&cache, methods);
+	osc_fmt_cache_init(&fmt_cache);
+
+	const osc_data_t *end = buf + sizeof(buf);
+	size_t size = 0;
+	int ok = 1;
+
+	unsigned i;
+	for(i=0; i<iterations; i++)
+	{
+		osc_data_t *ptr;
+		OSC_RT_MEASURE(&h_encode, ptr = _encode(buf, end, i));
+		size = ptr ? (size_t)(ptr - buf) : 0;
+
+		OSC_RT_MEASURE(&h_check, ok &= osc_check_packet(buf, size));
+		OSC_RT_MEASURE(&h_dispatch,
+			osc_dispatch_method(buf, size, methods, NULL, NULL, NULL));
+		OSC_RT_MEASURE(&h_cached,
+			osc_cache_dispatch_method(&cache, buf, size, NULL, NULL, NULL));
+
+		const int32_t len = be32toh(*(const int32_t *)(buf + 16));
+		OSC_RT_MEASURE(&h_compiled,
+			ok &= osc_check_message_compiled(&fmt_cache, buf + 20, len));
+
+		OSC_RT_MEASURE(&h_unroll,
+			const int n = osc_unroll_index(buf, size, items, NMSGS);
+			if(n > 0)
+				osc_unroll_dispatch(NULL, buf, items, n, OSC_UNROLL_ORDER_TOTAL,
+					_unroll_cb, NULL));
+	}
+
+	printf("%u iterations, bundles of %d messages, %zu bytes\n", iterations,
+		NMSGS, size);
+	osc_rt_hist_print(stdout, "encode", &h_encode);
+	osc_rt_hist_print(stdout, "check_packet", &h_check);
+	osc_rt_hist_print(stdout, "dispatch_method", &h_dispatch);
+	osc_rt_hist_print(stdout, "cache_dispatch_method", &h_cached);
+	osc_rt_hist_print(stdout, "check_message_compiled", &h_compiled);
+	osc_rt_hist_print(stdout, "unroll_total", &h_unroll);
+	printf("violations: alloc=%lu lock=%lu syscall=%lu\n",
+		osc_rt_violations(OSC_RT_ALLOC), osc_rt_violations(OSC_RT_LOCK),
+		osc_rt_violations(OSC_RT_SYSCALL));
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,210 @@
+/*
+ * Copyright (c) 2015 Hanspeter Portner (dev@open-music-kontrollers.ch)
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the Artistic License 2.0 as published by
+ * The Perl Foundation.
+ *
+ * This source is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * Artistic License 2.0 for more details.
+ *
+ * You should have received a copy of the Artistic License 2.0
+ * along the source as a COPYING file. If not, obtain it from
+ * http://www.perlfoundation.org/artistic_license_2_0.
+ */
+
+// c++ -std=c++20 -O2 -c osc_rt_test_hpp.cpp
+// cc -std=gnu11 -O2 -I.. osc_rt_test.c osc_rt_test_hpp.o -lstdc++ -ldl -pthread
+// no sanitizers, they interpose the allocator themselves
+
+#define _GNU_SOURCE
+#define OSC_RT_AUDIT_HOOKS
+
+#include <stdlib.h>
+#include <sys/socket.h>
+
+#include "../osc_rt.h"
+#include "../osc.h"
+#include "../osc_cache.h"
+#include "../osc_fmt.h"
+#include "../osc_swap.h"
+#include "../osc_time.h"
+#include "../osc_unroll.h"
+#include "minunit.h"
+
+#define ITERATIONS 10000
+
+int tests_run = 0;
+int tests_pass = 0;
+int tests_fail = 0;
+
+extern int osc_rt_test_hpp(unsigned iterations);
+
+static unsigned long
+_violations(void)
+{
+	return osc_rt_violations(OSC_RT_ALLOC) + osc_rt_violations(OSC_RT_LOCK)
+		+ osc_rt_violations(OSC_RT_SYSCALL);
+}
+
+static int
+_method_cb(osc_time_t time, const char *path, const char *fmt,
+	const osc_data_t *buf, size_t size, void *data)
+{
+	unsigned *count = data;
+
+	(void)time;
+	(void)path;
+	(void)fmt;
+	(void)buf;
+	(void)size;
+	(*count)++;
+
+	return 0;
+}
+
+static const osc_method_t methods [] = {
+	{"/gain", "if", _method_cb},
+	{NULL, NULL, _method_cb},
+	{NULL, NULL, NULL}
+};
+
+static void
+_unroll_cb(osc_time_t time, const osc_data_t *buf, size_t size, void *data)
+{
+	unsigned *count = data;
+
+	(void)time;
+	(void)buf;
+	(void)size;
+	(*count)++;
+}
+
+// the hooks count, and only inside audited sections
+static int
+test_hooks(void)
+{
+	int fds [2];
+	char byte = 0;
+
+	const unsigned long before = _violations();
+	void *volatile ptr = malloc(16);
+	free(ptr);
+	mu_check(_violations() == before);
+
+	mu_check(!socketpair(AF_UNIX, SOCK_DGRAM, 0, fds));
+
+	osc_rt_enter();
+	ptr = malloc(16);
+	free(ptr);
+	send(fds[0], &byte, 1, 0);
+	recv(fds[1], &byte, 1, 0);
+	struct iovec iov = { .iov_base = &byte, .iov_len = 1 };
+	struct mmsghdr msg = { .msg_hdr = { .msg_iov = &iov, .msg_iovlen = 1 } };
+	sendmmsg(fds[0], &msg, 1, 0);
+	recvmsg(fds[1], &msg.msg_hdr, 0);
+	osc_rt_leave();
+
+	mu_check(osc_rt_violations(OSC_RT_ALLOC) == 2);
+	mu_check(osc_rt_violations(OSC_RT_SYSCALL) == 4);
+	mu_check(_violations() == before + 6);
+
+	close(fds[0]);
+	close(fds[1]);
+
+	return 0;
+}
+
+// encode, validate, dispatch and unroll in a loop, nothing may violate
+static int
+test_load(void)
+{
+	static osc_data_t buf [1024];
+	static osc_cache_t cache;
+	static osc_fmt_cache_t fmt_cache;
+	static osc_unroll_item_t items [16];
+	static uint32_t swapped [64];
+	unsigned count = 0;
+
+	osc_cache_init(&cache, methods);
+	osc_fmt_cache_init(&fmt_cache);
+
+	const unsigned long before = _violations();
+
+	unsigned i;
+	for(i=0; i<ITERATIONS; i++)
+	{
+		osc_rt_enter();
+
+		const osc_data_t *end = buf + sizeof(buf);
+		osc_data_t *bndl = NULL;
+		osc_data_t *itm = NULL;
+		osc_data_t *ptr = osc_start_bundle(buf, end, OSC_IMMEDIATE, &bndl);
+		ptr = osc_start_bundle_item(ptr, end, &itm);
+		ptr = osc_set_vararg(ptr, end, "/gain", "if", i, 0.5);
+		ptr = osc_end_bundle_item(ptr, end, itm);
+		ptr = osc_start_bundle_item(ptr, end, &itm);
+		ptr = osc_set_vararg(ptr, end, "/name", "sh", "channel", (int64_t)i);
+		ptr = osc_end_bundle_item(ptr, end, itm);
+		ptr = osc_end_bundle(ptr, end, bndl);
+		const size_t size = ptr ? (size_t)(ptr - buf) : 0;
+
+		if(!osc_check_packet(buf, size))
+			count += 1000000;
+
+		osc_dispatch_method(buf, size, methods, NULL, NULL, &count);
+		osc_cache_dispatch_method(&cache, buf, size, NULL, NULL, &count);
+
+		// first message of bundle
+		const int32_t len = be32toh(*(const int32_t *)(buf + 16));
+		if(!osc_check_message_compiled(&fmt_cache, buf + 20, len))
+			count += 1000000;
+
+		const int n = osc_unroll_index(buf, size, items, 16);
+		if(n > 0)
+			osc_unroll_dispatch(NULL, buf, items, n, OSC_UNROLL_ORDER_TOTAL,
+				_unroll_cb, &count);
+
+		osc_swap32_n(swapped, buf, size / 4 < 64 ? size / 4 : 64);
+
+		struct timespec ts;
+		osc_time_to_timespec(osc_time_from_nsec(i * 1000ULL), &ts);
+
+		osc_rt_leave();
+	}
+
+	// /gain hits two methods, /name one, per dispatcher, plus two unrolled
+	mu_check(count == ITERATIONS * 8);
+	mu_check(_violations() == before);
+
+	return 0;
+}
+
+static int
+test_load_hpp(void)
+{
+	const unsigned long before = _violations();
+
+	mu_check(osc_rt_test_hpp(ITERATIONS) == 0);
+	mu_check(_violations() == before);
+
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	(void)argc;
+	(void)argv;
+
+	mu_run_test("hooks", test_hooks);
+	mu_run_test("load", test_load);
+	mu_run_test("load_hpp", test_load_hpp);
+
+	fprintf(stderr, "%d tests run, %d passed, %d failed\n", tests_run,
+		tests_pass, tests_fail);
+
+	return tests_fail ? 1 : 0;
+}
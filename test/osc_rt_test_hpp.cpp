@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2015 Hanspeter Portner (dev@open-music-kontrollers.ch)
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the Artistic License 2.0 as published by
+ * The Perl Foundation.
+ *
+ * This source is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * Artistic License 2.0 for more details.
+ *
+ * You should have received a copy of the Artistic License 2.0
+ * along the source as a COPYING file. If not, obtain it from
+ * http://www.perlfoundation.org/artistic_license_2_0.
+ */
+
+// C++ part of osc_rt_test.c, the audit hooks live there
+
+#include "../osc.hpp"
+#include "../osc_rt.h"
+
+// build, view and walk packets within packet_buffer::inline_size inside an
+// audited section, returns number of failed checks
+extern "C" int
+osc_rt_test_hpp(unsigned iterations)
+{
+	int failed = 0;
+
+	for(unsigned i = 0; i < iterations; i++)
+	{
+		osc_rt_enter();
+
+		osc::packet_builder builder;
+		{
+			auto bndl = builder.bundle(OSC_IMMEDIATE);
+			builder.item_message("/gain", "if", int32_t(i), 0.5f);
+			builder.item_message("/name", "s", "channel");
+			{
+				auto itm = builder.item();
+				auto nested = builder.bundle(1ULL << 32);
+				builder.item_message("/mute", "T");
+			}
+		}
+
+		const osc::bundle_view bundle(builder.data());
+		if(!builder.ok() || !bundle.valid())
+			failed++;
+
+		unsigned nmsgs = 0;
+		for(const osc::element item : bundle)
+		{
+			if(!item.is_message())
+				continue;
+
+			const osc::message_view msg(item.data());
+			if(!msg.valid())
+				failed++;
+			for(const osc::argument arg : msg)
+				if(arg.type() == OSC_INT32)
+					failed += (arg.as<int32_t>() != int32_t(i));
+			nmsgs++;
+		}
+		if(nmsgs != 2)
+			failed++;
+
+		osc_rt_leave();
+	}
+
+	return failed;
+}
@@ -0,0 +1,270 @@
+/*
+ * Copyright (c) 2015 Hanspeter Portner (dev@open-music-kontrollers.ch)
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the Artistic License 2.0 as published by
+ * The Perl Foundation.
+ *
+ * This source is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * Artistic License 2.0 for more details.
+ *
+ * You should have received a copy of the Artistic License 2.0
+ * along the source as a COPYING file. If not, obtain it from
+ * http://www.perlfoundation.org/artistic_license_2_0.
+ */
+
+// cc -std=gnu11 -O2 -pthread -fsanitize=thread -I.. osc_unroll_test.c
+
+#include <stdlib.h>
+
+#include "../osc_unroll.h"
+#include "minunit.h"
+
+#define NPATHS 13
+#define NMSGS 1000 // per nested bundle
+#define NBUNDLES 3
+
+int tests_run = 0;
+int tests_pass = 0;
+int tests_fail = 0;
+
+static const char *paths [NPATHS] = {
+	"/a", "/b", "/c", "/d", "/e", "/f", "/g", "/h", "/i", "/j", "/k", "/l", "/m"
+};
+
+static osc_data_t packet [NBUNDLES * NMSGS * 32 + 1024];
+static size_t packet_size;
+static osc_unroll_item_t items [NBUNDLES * NMSGS + NMSGS];
+
+typedef enum _order_t {
+	ORDER_TOTAL,
+	ORDER_ADDRESS,
+	ORDER_NONE
+} order_t;
+
+// sequence number of every message, in index order
+typedef struct _seen_t seen_t;
+
+struct _seen_t {
+	atomic_uint count [NBUNDLES * NMSGS + NMSGS];
+	int32_t last [NPATHS]; // last sequence number per path
+	atomic_int ordered;
+	unsigned total; // sequence numbers in callback order, TOTAL only
+	int32_t order [NBUNDLES * NMSGS + NMSGS];
+};
+
+static seen_t seen;
+
+// top-level messages after nested bundles, index has them first
+static void
+_build(void)
+{
+	osc_data_t *ptr = packet;
+	const osc_data_t *end = packet + sizeof(packet);
+	osc_data_t *bndl = NULL;
+	int32_t seq = 0;
+
+	srand(1);
+	ptr = osc_start_bundle(ptr, end, 1ULL << 32, &bndl);
+
+	unsigned b;
+	for(b=0; b<NBUNDLES; b++)
+	{
+		osc_data_t *itm = NULL;
+		osc_data_t *nested = NULL;
+		ptr = osc_start_bundle_item(ptr, end, &itm);
+		ptr = osc_start_bundle(ptr, end, (2ULL + b) << 32, &nested);
+
+		unsigned i;
+		for(i=0; i<NMSGS; i++)
+		{
+			osc_data_t *msg = NULL;
+			const unsigned p = rand() % NPATHS;
+			ptr = osc_start_bundle_item(ptr, end, &msg);
+			ptr = osc_set_vararg(ptr, end, paths[p], "ii", NMSGS + seq++, p);
+			ptr = osc_end_bundle_item(ptr, end, msg);
+		}
+
+		ptr = osc_end_bundle(ptr, end, nested);
+		ptr = osc_end_bundle_item(ptr, end, itm);
+	}
+
+	unsigned i;
+	for(i=0; i<NMSGS; i++)
+	{
+		osc_data_t *msg = NULL;
+		const unsigned p = rand() % NPATHS;
+		ptr = osc_start_bundle_item(ptr, end, &msg);
+		ptr = osc_set_vararg(ptr, end, paths[p], "ii", i, p);
+		ptr = osc_end_bundle_item(ptr, end, msg);
+	}
+
+	ptr = osc_end_bundle(ptr, end, bndl);
+	packet_size = ptr ? ptr - packet : 0;
+}
+
+static void
+_seen_reset(void)
+{
+	unsigned i;
+	for(i=0; i<NBUNDLES * NMSGS + NMSGS; i++)
+		atomic_init(&seen.count[i], 0);
+	for(i=0; i<NPATHS; i++)
+		seen.last[i] = -1;
+	atomic_init(&seen.ordered, 1);
+	seen.total = 0;
+}
+
+// messages of one path are never handed out concurrently in ADDRESS mode,
+// so last needs no synchronization there
+static void
+_item_cb(osc_time_t time, const osc_data_t *buf, size_t size, void *data)
+{
+	const order_t mode = *(const order_t *)data;
+	const char *path;
+	const char *fmt;
+	int32_t seq = 0;
+	int32_t p = 0;
+
+	(void)size;
+	buf = osc_get_path(buf, &path);
+	buf = osc_get_fmt(buf, &fmt);
+	buf = osc_get_int32(buf, &seq);
+	buf = osc_get_int32(buf, &p);
+
+	// nested bundles carry their own timetag
+	if(time != ( (seq < NMSGS) ? 1ULL << 32 : (2ULL + (seq - NMSGS) / NMSGS) << 32) )
+		atomic_store(&seen.ordered, 0);
+
+	atomic_fetch_add_explicit(&seen.count[seq], 1, memory_order_relaxed);
+
+	switch(mode)
+	{
+		case ORDER_TOTAL:
+			seen.order[seen.total++] = seq;
+			break;
+		case ORDER_ADDRESS:
+			if(seen.last[p] >= seq)
+				atomic_store(&seen.ordered, 0);
+			seen.last[p] = seq;
+			break;
+		case ORDER_NONE:
+			break;
+	}
+}
+
+static int
+_check_once(void)
+{
+	unsigned i;
+	for(i=0; i<NBUNDLES * NMSGS + NMSGS; i++)
+		mu_check(atomic_load(&seen.count[i]) == 1);
+
+	return 0;
+}
+
+static int
+test_index(void)
+{
+	_build();
+	mu_check(packet_size > 0);
+	mu_check(osc_check_packet(packet, packet_size));
+
+	const int n = osc_unroll_index(packet, packet_size, items,
+		sizeof(items) / sizeof(osc_unroll_item_t));
+	mu_check(n == NBUNDLES * NMSGS + NMSGS);
+
+	// too small
+	mu_check(osc_unroll_index(packet, packet_size, items, n - 1) == -1);
+	// malformed
+	mu_check(osc_unroll_index(packet, packet_size - 1, items, n) == -1);
+
+	return 0;
+}
+
+static int
+test_total(void)
+{
+	const int n = osc_unroll_index(packet, packet_size, items,
+		sizeof(items) / sizeof(osc_unroll_item_t));
+	order_t mode = ORDER_TOTAL;
+
+	_seen_reset();
+	osc_unroll_dispatch(NULL, packet, items, n, OSC_UNROLL_ORDER_TOTAL, _item_cb,
+		&mode);
+	mu_check(atomic_load(&seen.ordered));
+	mu_check(_check_once() == 0);
+
+	// top-level messages first, then the nested bundles, each in order
+	mu_check(seen.total == (unsigned)n);
+	int i;
+	for(i=0; i<n; i++)
+		mu_check(seen.order[i] == i);
+
+	return 0;
+}
+
+static int
+test_address(void)
+{
+	const int n = osc_unroll_index(packet, packet_size, items,
+		sizeof(items) / sizeof(osc_unroll_item_t));
+	order_t mode = ORDER_ADDRESS;
+
+	unsigned nthreads;
+	for(nthreads=0; nthreads<=OSC_POOL_THREADS; nthreads+=4)
+	{
+		osc_pool_t pool;
+		mu_check(osc_pool_init(&pool, nthreads));
+
+		_seen_reset();
+		osc_unroll_dispatch(&pool, packet, items, n, OSC_UNROLL_ORDER_ADDRESS,
+			_item_cb, &mode);
+		mu_check(atomic_load(&seen.ordered));
+		mu_check(_check_once() == 0);
+
+		osc_pool_deinit(&pool);
+	}
+
+	return 0;
+}
+
+static int
+test_none(void)
+{
+	const int n = osc_unroll_index(packet, packet_size, items,
+		sizeof(items) / sizeof(osc_unroll_item_t));
+	order_t mode = ORDER_NONE;
+
+	osc_pool_t pool;
+	mu_check(osc_pool_init(&pool, 4));
+
+	_seen_reset();
+	osc_unroll_dispatch(&pool, packet, items, n, OSC_UNROLL_ORDER_NONE, _item_cb,
+		&mode);
+	mu_check(atomic_load(&seen.ordered));
+	mu_check(_check_once() == 0);
+
+	osc_pool_deinit(&pool);
+
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	(void)argc;
+	(void)argv;
+
+	mu_run_test("index", test_index);
+	mu_run_test("total", test_total);
+	mu_run_test("address", test_address);
+	mu_run_test("none", test_none);
+
+	fprintf(stderr, "%d tests run, %d passed, %d failed\n", tests_run,
+		tests_pass, tests_fail);
+
+	return tests_fail ? 1 : 0;
+}